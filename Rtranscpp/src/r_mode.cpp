@@ -41,6 +41,7 @@ RCPP_MODULE(mod_mode)
   .constructor<string, string>()
   
   .property("occupancy_method", &ModePtr::get_occupancy_method , &ModePtr::set_occupancy_method )    
+  .property("numerics"        , &ModePtr::get_numerics         , &ModePtr::set_numerics         )
   .property("score_function"  , &ModePtr::get_score_function   , &ModePtr::set_score_function   )
   .property("scale_data_type" , &ModePtr::get_scale_data_type  , &ModePtr::set_scale_data_type  )
   .property("scale_to"        , &ModePtr::get_scale_to         , &ModePtr::set_scale_to         )
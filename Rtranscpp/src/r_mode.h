@@ -18,6 +18,7 @@ public:
   
   // getters
   string       get_occupancy_method() { return mode->getOccupancyMethod(); }     
+  string       get_numerics()         { return mode->getNumerics();        }
   string       get_score_function()   { return mode->getScoreFunction();   }
   string       get_scale_data_type()  { return mode->getScaleDataType();   }
   double       get_scale_to()         { return mode->getScaleTo();         }
@@ -41,6 +42,7 @@ public:
   
   // setters
   void set_occupancy_method(string occupancy_method)  { mode->setOccupancyMethod(occupancy_method); }
+  void set_numerics(string numerics)                  { mode->setNumerics(numerics);                }
   void set_score_function(string score_function)      { mode->setScoreFunction(score_function);     }
   void set_scale_data_type(string scale_data_type)    { mode->setScaleDataType(scale_data_type);    }
   void set_scale_to(double scale_to)                  { mode->setScaleTo(scale_to);                 }
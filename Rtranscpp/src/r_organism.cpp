@@ -297,21 +297,16 @@ List OrganismPtr::R2D()
     int left   = gene.getLeftBound();
     gene_names.push_back(gene.getName());
     
-    vector< vector<double> >& R_2D = nuclei->getR2D(gene);
+    WindowMatrix& R_2D = nuclei->getR2D(gene);
     
     int nwindows = R_2D.size();
     
+    // the windows are already laid out column major, as R wants them
+    NumericMatrix m(nrow, nwindows, R_2D.data());
+    
     vector<string> col_names;
-
-    NumericMatrix m(nrow, nwindows);
     for (int j=0; j<nwindows; j++)
-    {
-      vector<double>& v = R_2D[j];
-      for (int k=0; k<nrow; k++)
-        m(k,j) = v[k];
-
       col_names.push_back(to_string_( (j+1)*shift - window/2 + left));
-    }
     
     CharacterVector rows(nrow);
     CharacterVector cols(nwindows);
@@ -352,21 +347,16 @@ List OrganismPtr::N2D()
     int left   = gene.getLeftBound();
     gene_names.push_back(gene.getName());
     
-    vector< vector<double> >& N_2D = nuclei->getN2D(gene);
+    WindowMatrix& N_2D = nuclei->getN2D(gene);
     
     int nwindows = N_2D.size();
     
+    // the windows are already laid out column major, as R wants them
+    NumericMatrix m(nrow, nwindows, N_2D.data());
+    
     vector<string> col_names;
-
-    NumericMatrix m(nrow, nwindows);
     for (int j=0; j<nwindows; j++)
-    {
-      vector<double>& v = N_2D[j];
-      for (int k=0; k<nrow; k++)
-        m(k,j) = v[k];
-
       col_names.push_back(to_string_( (j+1)*shift - window/2 + left));
-    }
     
     CharacterVector rows(nrow);
     CharacterVector cols(nwindows);
@@ -407,21 +397,16 @@ List OrganismPtr::T2D()
     int left   = gene.getLeftBound();
     gene_names.push_back(gene.getName());
     
-    vector< vector<double> >& T_2D = nuclei->getT2D(gene);
+    WindowMatrix& T_2D = nuclei->getT2D(gene);
     
     int nwindows = T_2D.size();
     
+    // the windows are already laid out column major, as R wants them
+    NumericMatrix m(nrow, nwindows, T_2D.data());
+    
     vector<string> col_names;
-
-    NumericMatrix m(nrow, nwindows);
     for (int j=0; j<nwindows; j++)
-    {
-      vector<double>& v = T_2D[j];
-      for (int k=0; k<nrow; k++)
-        m(k,j) = v[k];
-
       col_names.push_back(to_string_( (j+1)*shift - window/2 + left));
-    }
     
     CharacterVector rows(nrow);
     CharacterVector cols(nwindows);
@@ -49,6 +49,7 @@ TF::TF():
   coef->setType("double");
   coef->setLimits(-1.0,1.0);
   coefs.push_back(coef);
+  snapshotCoefs();
 }
 
 TF::TF(ptree& pt, mode_ptr m):
@@ -81,6 +82,7 @@ void TF::set(ptree& pt)
     coef->setTFName(tfname);
     coefs.push_back(coef);
   }
+  snapshotCoefs();
   
   ptree& kmax_node = pt.get_child("kmax");
   kmax->read(kmax_node);
@@ -179,6 +181,18 @@ void TF::setCoefs(vector<double> c)
       coefs.push_back(coef);
     }
   }
+  snapshotCoefs();
+}
+
+/* the calculations read coefficients from a snapshot so they do not build a new
+vector every time they need them. Anything that moves a coefficient has to take
+a new snapshot before recalculating */
+void TF::snapshotCoefs()
+{
+  int ncoefs = coefs.size();
+  coef_values.resize(ncoefs);
+  for (int i=0; i<ncoefs; i++)
+    coef_values[i] = coefs[i]->getValue();
 }
     
 /*    Getters   */
@@ -313,6 +327,15 @@ bool TF::checkCoops(TF* t, char o1, char o2)
   return false;
 }
 
+double TF::getMaxCoopDistance()
+{
+  double max_dist = 0;
+  int ncoops = coops.size();
+  for (int i=0; i<ncoops; i++)
+    max_dist = max(max_dist, coops[i].second->getDist()->getMaxDistance());
+  return max_dist;
+}
+
 coop_ptr TF::getCoop(TF* t)
 {
   int ncoops = coops.size();
@@ -501,6 +524,13 @@ void TFContainer::setCoops(coops_ptr c)
   }
 }
 
+void TFContainer::snapshotCoefs()
+{
+  int ntfs = tfs.size();
+  for (int i=0; i<ntfs; i++)
+    tfs[i]->snapshotCoefs();
+}
+
 void TFContainer::setCoeffects(coeffects_ptr c)
 {
   int ntfs = tfs.size();
@@ -538,7 +568,7 @@ void TFContainer::add(ptree& pt, mode_ptr m)
           tf_ptr t(new TF(tf_node, mode) );
           tfs.push_back(t);
           int ntfs = tfs.size();
-          tfs[ntfs-1]->setIndex(ntfs);
+          tfs[ntfs-1]->setIndex(ntfs-1);
         }
       }
     }
@@ -556,7 +586,7 @@ void TFContainer::add(ptree& pt, mode_ptr m)
           tf_ptr t(new TF(tf_node, mode) );
           tfs.push_back(t);
           int ntfs = tfs.size();
-          tfs[ntfs-1]->setIndex(ntfs);
+          tfs[ntfs-1]->setIndex(ntfs-1);
         }
       }
     }
@@ -568,12 +598,16 @@ void TFContainer::add(ptree& pt, mode_ptr m)
       tf_ptr t(new TF(pt, mode) );
       tfs.push_back(t);
       int ntfs = tfs.size();
-      tfs[ntfs-1]->setIndex(ntfs);
+      tfs[ntfs-1]->setIndex(ntfs-1);
     }
   }
 } 
 
-void TFContainer::add(tf_ptr t) {tfs.push_back(t);}
+void TFContainer::add(tf_ptr t) 
+{
+  t->setIndex(tfs.size());
+  tfs.push_back(t);
+}
 
 /*    Output    */
 void TFContainer::write(ostream& os) const
@@ -46,6 +46,7 @@ private:
   double Kns; // the nonspecific binding energy
   
   vector<double_param_ptr> coefs;
+  vector<double>           coef_values; // coefs as of the last snapshotCoefs()
   
   // index is -log10(pval)*precision
   vector<double> s2p;
@@ -78,9 +79,11 @@ public:
   bool           ncoops() { return coops.size(); } // used to check if this ever cooperates
   bool           checkCoops(TF*, char, char); // check if this cooperates with tf
   coop_ptr       getCoop(TF*);
+  double         getMaxCoopDistance(); // the furthest this can cooperate, 0 if it never does
   bool           neverActivates();
   bool           neverQuenches();
   vector<double> getCoefs();
+  const vector<double>& getCoefSnapshot() { return coef_values; }
   int            getNumModes() { return coefs.size(); }
   int            getIndex()    { return index; }
   
@@ -110,11 +113,16 @@ public:
   void setIndex(int index) { this->index = index; }
   void setCoefs(vector<double>);
   void setMaxScore(double mscore) { energy.setMaxScore(mscore); } // WSB
+  void snapshotCoefs();
   
   // methods
   TFscore score(const string & s);     // score a string with tf
   TFscore score(const vector<int>& s); // score an int vector (faster) 
   void    score(const vector<int>& s, TFscore &t); // pass by reference (fastest) , 
+  void    getWindows(int len, const vector<int>& mutated, vector<int>& windows)
+                 { energy.getWindows(len, mutated, windows); }
+  void    rescore(const vector<int>& s, TFscore& t, const vector<int>& windows)
+                 { energy.rescore(s, t, windows); }
   
   // I/O
   void print(ostream& os);
@@ -151,6 +159,7 @@ public:
   void add(tf_ptr t);
   void setCoops(coops_ptr);
   void setCoeffects(coeffects_ptr);
+  void snapshotCoefs();
   
   // Output
   void write(ostream& os) const;
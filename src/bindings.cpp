@@ -13,11 +13,29 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/lexical_cast.hpp>
 #include <limits>
+#include <algorithm>
 
 #define foreach_ BOOST_FOREACH
 #define to_string_ boost::lexical_cast<string>
 
-Bindings::Bindings() {nnuc=0;}
+Bindings::Bindings() {nnuc=0; activity_version=1;}
+
+/* kv of a site in every nucleus. Where the tf is absent kv is 0, so only the
+runs of nuclei it is present in are calculated */
+static void set_kv(vector<double>& kv, vector<double>& v, const vector<int>& runs,
+                   double K_exp_part, double kmax, double kns)
+{
+  std::fill(kv.begin(), kv.end(), 0.0);
+  int nruns = runs.size();
+  for (int r=0; r<nruns; r+=2)
+  {
+    for (int i=runs[r]; i<runs[r+1]; i++)
+    {
+      double tf_kmax = kmax *v[i];
+      kv[i] = (K_exp_part*tf_kmax) / (1 + kns*tf_kmax);
+    }
+  }
+}
 
 void Bindings::clear()
 {
@@ -27,10 +45,19 @@ void Bindings::clear()
   saved_sites.clear();
 }
 
+/* everything indexed by gene or tf is sized as soon as we know them, so that
+nothing grows while genes are worked on in parallel */
 void Bindings::setGenes(genes_ptr g)
 {
   genes = g;
   int ngenes = genes->size();
+  scores.resize(ngenes);
+  saved_scores.resize(ngenes);
+  sites.resize(ngenes);
+  saved_sites.resize(ngenes);
+  pools.resize(ngenes);
+  ordered_sites_f.resize(ngenes);
+  ordered_sites_r.resize(ngenes);
   for (int i=0; i<ngenes; i++)
   {
     Gene& gene = genes->getGene(i);
@@ -45,10 +72,37 @@ void Bindings::setGenes(genes_ptr g)
     
     sites[&gene]       = gsites;
     saved_sites[&gene] = saved_gsites;
+    
+    pools[&gene] = site_pool_ptr(new SitePool);
+    
+    if (tfs) sizeGeneMaps(gene);
   }
 }
+
+void Bindings::setTFs(tfs_ptr t)
+{
+  tfs = t;
+  int ntfs = tfs->size();
+  conc.resize(ntfs);
+  tiled_conc.resize(ntfs);
+  active.resize(ntfs);
+  
+  if (!genes) return;
+  int ngenes = genes->size();
+  for (int i=0; i<ngenes; i++)
+    sizeGeneMaps(genes->getGene(i));
+}
+
+void Bindings::sizeGeneMaps(Gene& gene)
+{
+  int ntfs = tfs->size();
+  scores[&gene]->resize(ntfs);
+  saved_scores[&gene]->resize(ntfs);
+  sites[&gene]->resize(ntfs);
+  saved_sites[&gene]->resize(ntfs);
+}
     
-map<TF*, site_ptr_vector>& Bindings::getSites(Gene& gene)
+gene_sites_map& Bindings::getSites(Gene& gene)
 {
   return *(sites[&gene]);
 }
@@ -117,28 +171,11 @@ void Bindings::addSite(Gene* g, TF* t, site_ptr b)
 void Bindings::createScores()
 {
   int ngenes = genes->size();
-  int ntfs   = tfs->size();
   
   for (int i=0; i<ngenes; i++)
   {
     Gene& gene = genes->getGene(i);
-    
-    for (int j=0; j<ntfs; j++)
-    {
-      TF& tf = tfs->getTF(j);
-      createScores(gene, tf);
-    }
-  }
-}
-
-void Bindings::createScores(Gene& gene)
-{
-  int ntfs   = tfs->size();
-  
-  for (int j=0; j<ntfs; j++)
-  {
-    TF& tf = tfs->getTF(j);
-    createScores(gene, tf);
+    createScores(gene);
   }
 }
 
@@ -206,7 +243,7 @@ void Bindings::createSites(ptree& pt)
 
 void Bindings::createSite(site_ptr_vector& tmp_sites, Gene& gene, TF& tf, int m, int n, double score, double k, char orientation, double kmax, vector<double>& v, int nmodes, double kns)
 {
-  site_ptr b(new BindingSite);
+  site_ptr b = newSite(pools[&gene]);
   b->tf = &tf;
   b->orientation = orientation;
   b->m = m;
@@ -218,13 +255,10 @@ void Bindings::createSite(site_ptr_vector& tmp_sites, Gene& gene, TF& tf, int m,
 
   vector<double>& kv = b->kv;
   kv.resize(nnuc);
-  for(int i = 0; i < nnuc; i++)
-    {
-      double tf_kmax = kmax * v[i];
-      kv[i] = (b->K_exp_part * tf_kmax) / (1 + kns * tf_kmax);
-    }
+  set_kv(kv, v, active[&tf], b->K_exp_part, kmax, kns);
 
-  b->total_occupancy.resize(nnuc);
+  // a recycled site still holds its old occupancy
+  b->total_occupancy.assign(nnuc, 0.0);
   vector< vector<double> >& mode_occupancy = b->mode_occupancy;
   vector< vector<double> >& effective_occupancy = b->effective_occupancy;
 
@@ -232,10 +266,14 @@ void Bindings::createSite(site_ptr_vector& tmp_sites, Gene& gene, TF& tf, int m,
   effective_occupancy.resize(nmodes);
   for (int i=0; i<nmodes; i++)
     {
-      mode_occupancy[i].resize(nnuc);
-      effective_occupancy[i].resize(nnuc);
+      mode_occupancy[i].assign(nnuc, 0.0);
+      effective_occupancy[i].assign(nnuc, 0.0);
     }
 
+  b->saved_total_occupancy     = b->total_occupancy;
+  b->saved_mode_occupancy      = mode_occupancy;
+  b->saved_effective_occupancy = effective_occupancy;
+
   b->index_in_site_map = tmp_sites.size();
   tmp_sites.push_back(b);
 }
@@ -284,10 +322,10 @@ void Bindings::create()
     gene_sites_map&  gsites        = *(sites[&gene]);
     gene_sites_map&  saved_gsites  = *(saved_sites[&gene]);
     
+    createScores(gene);
     for (int j=0; j<ntfs; j++)
     {
       TF& tf = tfs->getTF(j);
-      createScores(gene, tf);
       createSites(gene, tf);
       
       saved_gscores[&tf] = gscores[&tf];
@@ -308,10 +346,10 @@ void Bindings::create(Gene& gene)
 {
   int ntfs   = tfs->size();
 
+  createScores(gene);
   for (int j=0; j<ntfs; j++)
   {
     TF& tf = tfs->getTF(j);
-    createScores(gene, tf);
     createSites(gene, tf);
   }
   order_sites(gene);
@@ -331,6 +369,37 @@ void Bindings::createScores(Gene& gene, TF& tf)
   gscores[&tf] = tf.score(gene.getSequence());
 }
 
+/* scores every tf over the gene. The pssms are scanned together, so the
+sequence is only read once */
+void Bindings::createScores(Gene& gene)
+{
+  gene_scores_map& gscores = *(scores[&gene]);
+  vector<int>&     seq     = gene.getSequence();
+  int              len     = seq.size();
+  
+  PWMScanner       scanner;
+  vector<TFscore*> pwm_scores;
+  
+  int ntfs = tfs->size();
+  for (int i=0; i<ntfs; i++)
+  {
+    TF&      tf = tfs->getTF(i);
+    TFscore& t  = gscores[&tf];
+    if (!tf.getPWM().isPWM())
+    {
+      tf.score(seq, t);
+      continue;
+    }
+    t.fscore.resize(len);
+    t.rscore.resize(len);
+    t.mscore.resize(len);
+    t.ranked.clear();
+    scanner.add(tf.getPWM());
+    pwm_scores.push_back(&t);
+  }
+  scanner.scan(seq, pwm_scores, 0, len);
+}
+
 TFscore& Bindings::getScores(Gene& gene, TF& tf) 
 { 
   gene_scores_map& gscores = *(scores[&gene]);
@@ -406,7 +475,7 @@ void Bindings::createSite(site_ptr_vector& tmp_sites, Gene& gene, TF& tf,
                           double lambda, double kmax, double maxscore,vector<double>& v, 
                           int nmodes, double kns)
 {
-  site_ptr b(new BindingSite);
+  site_ptr b = newSite(pools[&gene]);
   b->tf                    = &tf;
   b->orientation           = orientation;
   b->m                     = floor(pos  - bsize/2);
@@ -430,13 +499,10 @@ void Bindings::createSite(site_ptr_vector& tmp_sites, Gene& gene, TF& tf,
   
   vector<double>& kv = b->kv;
   kv.resize(nnuc);
-  for (int i=0; i<nnuc; i++)
-  {
-    double tf_kmax = kmax *v[i];
-    kv[i] = (b->K_exp_part * tf_kmax) / (1 + kns * tf_kmax);
-  }
+  set_kv(kv, v, active[&tf], b->K_exp_part, kmax, kns);
   
-  b->total_occupancy.resize(nnuc);
+  // a recycled site still holds its old occupancy
+  b->total_occupancy.assign(nnuc, 0.0);
 
   vector< vector<double> >& mode_occupancy      = b->mode_occupancy;
   vector< vector<double> >& effective_occupancy = b->effective_occupancy;
@@ -445,10 +511,14 @@ void Bindings::createSite(site_ptr_vector& tmp_sites, Gene& gene, TF& tf,
   effective_occupancy.resize(nmodes);
   for (int i=0; i<nmodes; i++)
   {
-    mode_occupancy[i].resize(nnuc);
-    effective_occupancy[i].resize(nnuc);
+    mode_occupancy[i].assign(nnuc, 0.0);
+    effective_occupancy[i].assign(nnuc, 0.0);
   }
   
+  b->saved_total_occupancy     = b->total_occupancy;
+  b->saved_mode_occupancy      = mode_occupancy;
+  b->saved_effective_occupancy = effective_occupancy;
+  
   b->index_in_site_map = tmp_sites.size();
   tmp_sites.push_back(b);
   
@@ -540,9 +610,177 @@ void Bindings::order_sites(Gene& gene)
   }
 }
 
+/* when only the sites of tf changed, its old sites are taken out of the ordered
+lists and its new ones merged in, instead of sorting every site of the gene */
+void Bindings::order_sites(Gene& gene, TF& tf)
+{
+  vector<BindingSite*>& fsites = ordered_sites_f[&gene];
+  vector<BindingSite*>& rsites = ordered_sites_r[&gene];
+  
+  gene_sites_map& gsites = *(sites[&gene]);
+  site_ptr_vector& tf_sites = gsites[&tf];
+  int ntfsites = tf_sites.size();
+  
+  int nkept = 0;
+  int nsites = fsites.size();
+  for (int i=0; i<nsites; i++)
+  {
+    if (fsites[i]->tf != &tf)
+      fsites[nkept++] = fsites[i];
+  }
+  fsites.resize(nkept + ntfsites);
+  for (int j=0; j<ntfsites; j++)
+    fsites[nkept + j] = tf_sites[j].get();
+  std::sort(fsites.begin() + nkept, fsites.end(), compareBindingSiteRight);
+  std::inplace_merge(fsites.begin(), fsites.begin() + nkept, fsites.end(), compareBindingSiteRight);
+  
+  nkept = 0;
+  for (int i=0; i<nsites; i++)
+  {
+    if (rsites[i]->tf != &tf)
+      rsites[nkept++] = rsites[i];
+  }
+  rsites.resize(nkept + ntfsites);
+  for (int j=0; j<ntfsites; j++)
+    rsites[nkept + j] = tf_sites[j].get();
+  std::sort(rsites.begin() + nkept, rsites.end(), compareBindingSiteLeft);
+  std::inplace_merge(rsites.begin(), rsites.begin() + nkept, rsites.end(), compareBindingSiteLeft);
+  
+  nsites = fsites.size();
+  for (int i=0; i<nsites; i++)
+  {
+    fsites[i]->index_in_ordered_f = i;
+    rsites[i]->index_in_ordered_r = i;
+  }
+}
+
+/* a candidate becomes a site when both mscore and the score of its strand pass
+the threshold, so it is ranked on the lower of the two */
+static double candidateScore(TFscore& t, int c)
+{
+  int k = c >> 1;
+  return min(t.mscore[k], (c & 1) ? t.rscore[k] : t.fscore[k]);
+}
+
+struct CandidateOrder
+{
+  TFscore& t;
+  CandidateOrder(TFscore& s) : t(s) {}
+  
+  bool operator()(int a, int b) const
+  {
+    double sa = candidateScore(t, a);
+    double sb = candidateScore(t, b);
+    if (sa != sb)
+      return sa > sb;
+    return a < b;
+  }
+};
+
+struct AboveThreshold
+{
+  TFscore& t;
+  double   threshold;
+  AboveThreshold(TFscore& s, double th) : t(s), threshold(th) {}
+  
+  bool operator()(int c) const { return candidateScore(t, c) >= threshold; }
+};
+
+void Bindings::rankCandidates(TFscore& t)
+{
+  int ncandidates = 2*t.mscore.size();
+  vector<int>& ranked = t.ranked;
+  ranked.resize(ncandidates);
+  for (int c=0; c<ncandidates; c++)
+    ranked[c] = c;
+  std::sort(ranked.begin(), ranked.end(), CandidateOrder(t));
+}
+
+/* Without trimming, the sites of a tf are always the best ranked candidates,
+the ones above the threshold. So moving the threshold only creates the sites
+between the old and the new one, or drops them, and everything else stays. */
+void Bindings::updateThreshold(Gene& gene, TF& tf)
+{
+  if (!mode->getSelfCompetition() || mode->getBindingSiteList())
+  {
+    updateSites(gene, tf);
+    return;
+  }
+  
+  gene_sites_map&  gsites   = *(sites[&gene]);
+  site_ptr_vector& tf_sites = gsites[&tf];
+  gene_scores_map& gscores  = *(scores[&gene]);
+  TFscore&         t        = gscores[&tf];
+  
+  if (t.ranked.empty())
+    rankCandidates(t);
+  
+  vector<int>& ranked    = t.ranked;
+  double       threshold = tf.getThreshold();
+  int nold = tf_sites.size();
+  int nnew = std::partition_point(ranked.begin(), ranked.end(), AboveThreshold(t, threshold)) - ranked.begin();
+  
+  if (nnew < nold)
+  {
+    int nkept = 0;
+    for (int i=0; i<nold; i++)
+    {
+      BindingSite& b = *tf_sites[i];
+      int c = 2*b.pos + (b.orientation == 'R');
+      if (candidateScore(t, c) >= threshold)
+        tf_sites[nkept++] = tf_sites[i];
+    }
+    tf_sites.resize(nkept);
+  }
+  else if (nnew > nold)
+  {
+    int    nmodes   = tf.getNumModes();
+    double bsize    = tf.getBindingSize();
+    double kmax     = tf.getKmax();
+    double maxscore = tf.getMaxScore();
+    double lambda   = tf.getLambda();
+    double kns      = tf.getKns();
+    vector<double>& v = conc[&tf];
+    
+    // in position order, which is the order createSites leaves them in
+    vector<int> added(ranked.begin() + nold, ranked.begin() + nnew);
+    std::sort(added.begin(), added.end());
+    
+    site_ptr_vector new_sites;
+    int nadded = added.size();
+    for (int j=0; j<nadded; j++)
+    {
+      int  k = added[j] >> 1;
+      char orientation = (added[j] & 1) ? 'R' : 'F';
+      double score     = (added[j] & 1) ? t.rscore[k] : t.fscore[k];
+      createSite(new_sites, gene, tf, k, bsize, score, orientation, lambda, kmax, maxscore, v, nmodes, kns);
+    }
+    
+    site_ptr_vector merged(nold + nadded);
+    int i = 0, j = 0, m = 0;
+    while (i < nold || j < nadded)
+    {
+      if (j == nadded || (i < nold && 2*tf_sites[i]->pos + (tf_sites[i]->orientation == 'R') < added[j]))
+        merged[m++] = tf_sites[i++];
+      else
+        merged[m++] = new_sites[j++];
+    }
+    tf_sites.swap(merged);
+  }
+  else
+    return;
+  
+  int nsites = tf_sites.size();
+  for (int i=0; i<nsites; i++)
+    tf_sites[i]->index_in_site_map = i;
+  
+  order_sites(gene, tf);
+}
+
 void Bindings::updateK(Gene& gene, TF& tf)
 {
   vector<double>&  v      = conc[&tf];
+  vector<int>&     runs   = active[&tf];
   double           kmax   = tf.getKmax();
   //double           offset = tf.getPWMOffset();
   double           kns    = tf.getKns(); 
@@ -559,18 +797,14 @@ void Bindings::updateK(Gene& gene, TF& tf)
     BindingSite* b = tmp_sites[k].get();
     double K_exp_part_times_kmax = kmax * b->K_exp_part;
     b->K_exp_part_times_kmax = K_exp_part_times_kmax;
-    vector<double>& kv = b->kv;
-    for (int i=0; i<nnuc; i++)
-    {
-      double tf_kmax = kmax *v[i];
-      kv[i] = (b->K_exp_part*tf_kmax) / (1 + kns*tf_kmax);
-    }
+    set_kv(b->kv, v, runs, b->K_exp_part, kmax, kns);
   }
 }
 
 void Bindings::updateK(TF& tf)
 {
   vector<double>&  v      = conc[&tf];
+  vector<int>&     runs   = active[&tf];
   double           kmax   = tf.getKmax();
   //double           offset = tf.getPWMOffset();
   double           kns    = tf.getKns(); 
@@ -591,12 +825,7 @@ void Bindings::updateK(TF& tf)
       BindingSite* b = tmp_sites[k].get();
       double K_exp_part_times_kmax = kmax * b->K_exp_part;
       b->K_exp_part_times_kmax = K_exp_part_times_kmax;
-      vector<double>& kv = b->kv;
-      for (int i=0; i<nnuc; i++)
-      {
-        double tf_kmax = kmax *v[i];
-        kv[i] = (b->K_exp_part*tf_kmax) / (1 + kns*tf_kmax);
-      }
+      set_kv(b->kv, v, runs, b->K_exp_part, kmax, kns);
     }
   }
 }
@@ -615,6 +844,7 @@ void Bindings::updateKandLambda(Gene& gene)
 void Bindings::updateKandLambda(Gene& gene, TF& tf)
 {
   vector<double>&     v = conc[&tf];
+  vector<int>&     runs = active[&tf];
   
   double   kmax     = tf.getKmax();
   double   lambda   = tf.getLambda();
@@ -644,18 +874,14 @@ void Bindings::updateKandLambda(Gene& gene, TF& tf)
     double K_exp_part_times_kmax = kmax * b->K_exp_part;
     
     b->K_exp_part_times_kmax = K_exp_part_times_kmax;
-    vector<double>& kv = b->kv;
-    for (int i=0; i<nnuc; i++)
-    {
-      double tf_kmax = kmax *v[i];
-      kv[i] = (b->K_exp_part*tf_kmax) / (1 + kns*tf_kmax);
-    }
+    set_kv(b->kv, v, runs, b->K_exp_part, kmax, kns);
   }
 }
 
 void Bindings::updateKandLambda(TF& tf)
 {
   vector<double>&     v = conc[&tf];
+  vector<int>&     runs = active[&tf];
   
   double   kmax     = tf.getKmax();
   double   lambda   = tf.getLambda();
@@ -691,12 +917,7 @@ void Bindings::updateKandLambda(TF& tf)
       double K_exp_part_times_kmax = kmax * b->K_exp_part;
       
       b->K_exp_part_times_kmax = K_exp_part_times_kmax;
-      vector<double>& kv = b->kv;
-      for (int i=0; i<nnuc; i++)
-      {
-        double tf_kmax = kmax *v[i];
-        kv[i] = (b->K_exp_part*tf_kmax) / (1 + kns*tf_kmax);
-      }
+      set_kv(b->kv, v, runs, b->K_exp_part, kmax, kns);
     }
   }
 }
@@ -715,12 +936,77 @@ void Bindings::addNuc(string& nuc_id)
   {
     TF& tf = tfs->getTF(i);
     const string& tfname = tf.getName();
-    conc[&tf].push_back(tfdata->getDataPoint("TF",tfname, "ID",nuc_id));
+    double c = tfdata->getDataPoint("TF",tfname, "ID",nuc_id);
+    conc[&tf].push_back(c);
+    
+    // extend the last run if it ends on this nucleus, or start a new one
+    vector<int>& runs = active[&tf];
+    if (c != 0)
+    {
+      if (!runs.empty() && runs.back() == nnuc-1)
+        runs.back() = nnuc;
+      else
+      {
+        runs.push_back(nnuc-1);
+        runs.push_back(nnuc);
+      }
+    }
   }
+  activity_version++;
+}
+
+// rebuild the runs of nuclei each tf is present in from conc
+void Bindings::setActive()
+{
+  int ntfs = tfs->size();
+  for (int i=0; i<ntfs; i++)
+  {
+    TF* tf = tfs->getTFptr(i).get();
+    vector<double>& v    = conc[tf];
+    vector<int>&    runs = active[tf];
+    runs.clear();
+    for (int j=0; j<nnuc; j++)
+    {
+      if (v[j] == 0) continue;
+      int start = j;
+      while (j<nnuc && v[j] != 0) j++;
+      runs.push_back(start);
+      runs.push_back(j);
+    }
+  }
+  activity_version++;
 }
 
 
 
+void Bindings::setTileSize(int size)
+{
+  tiled_IDs  = IDs;
+  tiled_conc = conc;
+  nnuc       = size;
+  setTile(0);
+}
+
+/* sites hold nuclei start to start+nnuc-1 from now on. Nothing is recalculated,
+that is up to the caller */
+void Bindings::setTile(int start)
+{
+  int nreal = min(nnuc, (int) tiled_IDs.size() - start);
+  
+  IDs.assign(tiled_IDs.begin() + start, tiled_IDs.begin() + start + nreal);
+  
+  int ntfs = tfs->size();
+  for (int i=0; i<ntfs; i++)
+  {
+    TF* tf = tfs->getTFptr(i).get();
+    vector<double>& all_conc = tiled_conc[tf];
+    vector<double>& v        = conc[tf];
+    v.assign(nnuc, 0.0);
+    copy(all_conc.begin() + start, all_conc.begin() + start + nreal, v.begin());
+  }
+  setActive();
+}
+
 void Bindings::saveScores(TF& tf)
 {
   int ngenes = genes->size();
@@ -737,7 +1023,33 @@ void Bindings::saveScores(Gene& gene, TF& tf)
   gene_scores_map& saved_gscores = *(saved_scores[&gene]);
 
   saved_gscores[&tf] = gscores[&tf];
+  saved_gscores[&tf].windows.clear();
+}
 
+/* save only the runs of windows that are about to be rescored. The ranked
+sites are thrown away by rescoring anyway, so they are swapped out whole */
+void Bindings::saveScores(Gene& gene, TF& tf, const vector<int>& windows)
+{
+  TFscore& t     = (*(scores[&gene]))[&tf];
+  TFscore& saved = (*(saved_scores[&gene]))[&tf];
+  
+  int len = t.mscore.size();
+  saved.fscore.resize(len);
+  saved.rscore.resize(len);
+  saved.mscore.resize(len);
+  
+  int nruns = windows.size();
+  for (int r=0; r<nruns; r+=2)
+  {
+    int from = windows[r];
+    int to   = windows[r+1];
+    copy(t.fscore.begin() + from, t.fscore.begin() + to, saved.fscore.begin() + from);
+    copy(t.rscore.begin() + from, t.rscore.begin() + to, saved.rscore.begin() + from);
+    copy(t.mscore.begin() + from, t.mscore.begin() + to, saved.mscore.begin() + from);
+  }
+  saved.maxscore = t.maxscore;
+  saved.ranked.swap(t.ranked);
+  saved.windows = windows;
 }
 
 void Bindings::restoreScores(TF& tf)
@@ -750,11 +1062,31 @@ void Bindings::restoreScores(TF& tf)
   }
 }
 
+/* A restore can come twice for one save, when a move went out of bounds, so the
+saved copy is left in place. Only the ranked sites are swapped back, which at
+worst leaves them empty, to be ranked again when a threshold next moves */
 void Bindings::restoreScores(Gene& gene, TF& tf)
 {
-  gene_scores_map& gscores       = *(scores[&gene]);
-  gene_scores_map& saved_gscores = *(saved_scores[&gene]);
-  gscores[&tf] = saved_gscores[&tf];
+  TFscore& t     = (*(scores[&gene]))[&tf];
+  TFscore& saved = (*(saved_scores[&gene]))[&tf];
+  
+  if (saved.windows.empty())
+  {
+    t = saved;
+    return;
+  }
+  
+  int nruns = saved.windows.size();
+  for (int r=0; r<nruns; r+=2)
+  {
+    int from = saved.windows[r];
+    int to   = saved.windows[r+1];
+    copy(saved.fscore.begin() + from, saved.fscore.begin() + to, t.fscore.begin() + from);
+    copy(saved.rscore.begin() + from, saved.rscore.begin() + to, t.rscore.begin() + from);
+    copy(saved.mscore.begin() + from, saved.mscore.begin() + to, t.mscore.begin() + from);
+  }
+  t.maxscore = saved.maxscore;
+  t.ranked.swap(saved.ranked);
 }
 
 void Bindings::updateScores(Gene& gene, TF& tf)
@@ -763,6 +1095,13 @@ void Bindings::updateScores(Gene& gene, TF& tf)
   gscores[&tf] = tf.score(gene.getSequence());
 }
 
+// after bases of the sequence mutated, only the windows that read them move
+void Bindings::updateScores(Gene& gene, TF& tf, const vector<int>& windows)
+{
+  gene_scores_map& gscores = *(scores[&gene]);
+  tf.rescore(gene.getSequence(), gscores[&tf], windows);
+}
+
 void Bindings::updateScores(TF& tf)
 {
   int ngenes = genes->size();
@@ -775,29 +1114,12 @@ void Bindings::updateScores(TF& tf)
 
 void Bindings::updateScores()
 {
-  int ntfs   = tfs->size();
-  int ngenes = genes->size();
-  for (int i=0; i<ngenes; i++)
-  {
-    Gene& gene = genes->getGene(i);
-    for (int j=0; j<ntfs; j++)
-    {
-      TF& tf = tfs->getTF(j);
-      updateScores(gene, tf);
-    }
-  }
+  createScores();
 }
 
 void Bindings::updateScores(Gene& gene)
 {
-  gene_scores_map& gscores = *(scores[&gene]);
-  
-  int ntfs = tfs->size();
-  for (int i=0; i<ntfs; i++)
-  {
-    TF& tf = tfs->getTF(i);
-    gscores[&tf] = tf.score(gene.getSequence());
-  }
+  createScores(gene);
 }
 
 void Bindings::updateSites()
@@ -866,11 +1188,72 @@ void Bindings::updateSites(Gene& gene, TF& tf)
   //verify_order(gene, tf);
   eraseTF(gene,tf);
   createSites(gene,tf);
-  order_sites(gene);
+  order_sites(gene, tf);
   //cerr << "verify after update for " << tf.getName() << endl;
   //verify_order(gene, tf);
 }
 
+/* Only the windows that were rescored can gain or lose a site, given as runs of
+start,end pairs. Everything outside them is kept and the sites found inside are
+merged in by position, the order createSites leaves them in. */
+void Bindings::updateSites(Gene& gene, TF& tf, const vector<int>& windows)
+{
+  if (!mode->getSelfCompetition() || mode->getBindingSiteList())
+  {
+    updateSites(gene, tf);
+    return;
+  }
+  
+  gene_sites_map&  gsites   = *(sites[&gene]);
+  site_ptr_vector& tf_sites = gsites[&tf];
+  gene_scores_map& gscores  = *(scores[&gene]);
+  TFscore&         t        = gscores[&tf];
+  
+  int    nmodes    = tf.getNumModes();
+  double threshold = tf.getThreshold();
+  double bsize     = tf.getBindingSize();
+  double kmax      = tf.getKmax();
+  double maxscore  = tf.getMaxScore();
+  double lambda    = tf.getLambda();
+  double kns       = tf.getKns();
+  vector<double>& v = conc[&tf];
+  
+  int nold  = tf_sites.size();
+  int nruns = windows.size();
+  
+  site_ptr_vector merged;
+  merged.reserve(nold);
+  int i = 0;
+  for (int r=0; r<nruns; r+=2)
+  {
+    int start = windows[r];
+    int end   = windows[r+1];
+    
+    while (i < nold && tf_sites[i]->pos < start)
+      merged.push_back(tf_sites[i++]);
+    while (i < nold && tf_sites[i]->pos < end)
+      i++;
+    
+    for (int k=start; k<end; k++)
+    {
+      if (t.mscore[k] < threshold) continue;
+      if (t.fscore[k] >= threshold)
+        createSite(merged, gene, tf, k, bsize, t.fscore[k], 'F', lambda, kmax, maxscore, v, nmodes, kns);
+      if (t.rscore[k] >= threshold)
+        createSite(merged, gene, tf, k, bsize, t.rscore[k], 'R', lambda, kmax, maxscore, v, nmodes, kns);
+    }
+  }
+  while (i < nold)
+    merged.push_back(tf_sites[i++]);
+  tf_sites.swap(merged);
+  
+  int nsites = tf_sites.size();
+  for (int j=0; j<nsites; j++)
+    tf_sites[j]->index_in_site_map = j;
+  
+  order_sites(gene, tf);
+}
+
 /* 
 a function to verify that the ordered sites and tfs all point to the right 
 places. We need to do do comparisons to do wo. First, we need to verify that 
@@ -980,9 +1363,15 @@ void::Bindings::restoreSites(Gene& gene, TF& tf)
   //}
   gene_sites_map& saved_gsites = *(saved_sites[&gene]);
   gene_sites_map& gsites       = *(sites[&gene]);
-  gsites[&tf] = saved_gsites[&tf];
+  site_ptr_vector& tf_sites = gsites[&tf];
+  tf_sites = saved_gsites[&tf];
   //sites[&gene][&tf] = saved_sites[&gene][&tf];
-  order_sites(gene); 
+  
+  // sites the move kept may have moved in the site vector
+  int nsites = tf_sites.size();
+  for (int i=0; i<nsites; i++)
+    tf_sites[i]->index_in_site_map = i;
+  order_sites(gene, tf);
   //cerr << "fsites.size() = " << ordered_sites_f[&gene].size() << endl;
   //cerr << "rsites.size() = " << ordered_sites_r[&gene].size() << endl;
   
@@ -996,6 +1385,11 @@ void::Bindings::restoreSites(Gene& gene, TF& tf)
 }
 
 
+/* Saving occupancy swaps the current buffers into the saved ones instead of
+copying them. Every move that saves occupancy recalculates it for the whole
+gene, which overwrites the stale buffers left behind, and restoring swaps the
+saved ones back. kv is not saved, moves that change it recalculate it when they
+are restored */
 void Bindings::saveOccupancy()
 {
   int ngenes = genes->size();
@@ -1016,7 +1410,7 @@ void Bindings::saveOccupancy(Gene& gene)
     int nsites = tfsites.size();
     
     for (int j=0; j<nsites; j++)
-      tfsites[j]->saved_total_occupancy = tfsites[j]->total_occupancy;
+      tfsites[j]->total_occupancy.swap(tfsites[j]->saved_total_occupancy);
   }
 }
         
@@ -1040,7 +1434,7 @@ void Bindings::restoreOccupancy(Gene& gene)
     int nsites = tfsites.size();
     
     for (int j=0; j<nsites; j++)
-      tfsites[j]->total_occupancy = tfsites[j]->saved_total_occupancy;
+      tfsites[j]->total_occupancy.swap(tfsites[j]->saved_total_occupancy);
   }
 }
 
@@ -1066,7 +1460,7 @@ void Bindings::saveEffectiveOccupancy(Gene& gene)
     int nsites = tfsites.size();
     
     for (int j=0; j<nsites; j++)
-      tfsites[j]->saved_effective_occupancy = tfsites[j]->effective_occupancy;
+      tfsites[j]->effective_occupancy.swap(tfsites[j]->saved_effective_occupancy);
   }
 }
 
@@ -1093,7 +1487,7 @@ void Bindings::restoreEffectiveOccupancy(Gene& gene)
     int nsites = tfsites.size();
     
     for (int j=0; j<nsites; j++)
-      tfsites[j]->effective_occupancy = tfsites[j]->saved_effective_occupancy;
+      tfsites[j]->effective_occupancy.swap(tfsites[j]->saved_effective_occupancy);
   }
 }
 
@@ -1121,8 +1515,8 @@ void Bindings::saveModeOccupancy(Gene& gene)
     
     for (int j=0; j<nsites; j++)
     {
-      tfsites[j]->saved_effective_occupancy = tfsites[j]->effective_occupancy;
-      tfsites[j]->saved_mode_occupancy      = tfsites[j]->mode_occupancy;
+      tfsites[j]->effective_occupancy.swap(tfsites[j]->saved_effective_occupancy);
+      tfsites[j]->mode_occupancy.swap(tfsites[j]->saved_mode_occupancy);
     }
   }
 }
@@ -1152,8 +1546,8 @@ void Bindings::restoreModeOccupancy(Gene& gene)
     
     for (int j=0; j<nsites; j++)
     {
-      tfsites[j]->effective_occupancy = tfsites[j]->saved_effective_occupancy;
-      tfsites[j]->mode_occupancy      = tfsites[j]->saved_mode_occupancy;
+      tfsites[j]->effective_occupancy.swap(tfsites[j]->saved_effective_occupancy);
+      tfsites[j]->mode_occupancy.swap(tfsites[j]->saved_mode_occupancy);
     }
   }
 }
@@ -1180,10 +1574,9 @@ void Bindings::saveAllOccupancy(Gene& gene)
     for (int j=0; j<nsites; j++)
     {
       site_ptr b = tfsites[j];
-      b->saved_kv                  = b->kv;
-      b->saved_effective_occupancy = b->effective_occupancy;
-      b->saved_mode_occupancy      = b->mode_occupancy;
-      b->saved_total_occupancy     = b->total_occupancy;
+      b->effective_occupancy.swap(b->saved_effective_occupancy);
+      b->mode_occupancy.swap(b->saved_mode_occupancy);
+      b->total_occupancy.swap(b->saved_total_occupancy);
     }
   }
 }
@@ -1209,10 +1602,9 @@ void Bindings::restoreAllOccupancy(Gene& gene)
     for (int j=0; j<nsites; j++)
     {
       site_ptr b = tfsites[j];
-      b->kv                  = b->saved_kv;
-      b->mode_occupancy      = b->saved_mode_occupancy;
-      b->effective_occupancy = b->saved_effective_occupancy;
-      b->total_occupancy     = b->saved_total_occupancy;
+      b->effective_occupancy.swap(b->saved_effective_occupancy);
+      b->mode_occupancy.swap(b->saved_mode_occupancy);
+      b->total_occupancy.swap(b->saved_total_occupancy);
     }
   }
 }
@@ -1487,7 +1879,7 @@ void Bindings::printTotalOccupancy(Gene& gene, ostream& os, bool invert)
   
     os << endl;
   
-    for (int nuc=0; nuc<nnuc; nuc++)
+    for (int nuc=0; nuc<(int) IDs.size(); nuc++)
     {
       string& id = IDs[nuc];
       os << setw(w) << id;
@@ -1506,7 +1898,7 @@ void Bindings::printTotalOccupancy(Gene& gene, ostream& os, bool invert)
   else 
   {
     os << setw(w) << "site";
-    for (int nuc=0; nuc<nnuc; nuc++)
+    for (int nuc=0; nuc<(int) IDs.size(); nuc++)
     {
       string& id = IDs[nuc];
       os << setw(w) << id;
@@ -1526,7 +1918,7 @@ void Bindings::printTotalOccupancy(Gene& gene, ostream& os, bool invert)
         header += num;
         //header << i;
         os << setw(w) <<  header;
-        for (int nuc=0; nuc<nnuc; nuc++)
+        for (int nuc=0; nuc<(int) IDs.size(); nuc++)
         {
           os << setw(w) << tmp_sites[i]->total_occupancy[nuc];
         }
@@ -1576,7 +1968,7 @@ void Bindings::printEffectiveOccupancy(Gene& gene, ostream& os, bool invert)
   
     os << endl;
   
-    for (int nuc=0; nuc<nnuc; nuc++)
+    for (int nuc=0; nuc<(int) IDs.size(); nuc++)
     {
       string& id = IDs[nuc];
       os << setw(w) << id;
@@ -1599,7 +1991,7 @@ void Bindings::printEffectiveOccupancy(Gene& gene, ostream& os, bool invert)
   else 
   {
     os << setw(w) << "site";
-    for (int nuc=0; nuc<nnuc; nuc++)
+    for (int nuc=0; nuc<(int) IDs.size(); nuc++)
     {
       string& id = IDs[nuc];
       os << setw(w) << id;
@@ -1624,7 +2016,7 @@ void Bindings::printEffectiveOccupancy(Gene& gene, ostream& os, bool invert)
           header += num;
           //header << i;
           os << setw(w) <<  header;
-          for (int nuc=0; nuc<nnuc; nuc++)
+          for (int nuc=0; nuc<(int) IDs.size(); nuc++)
           {
             os << setw(w) << tmp_sites[i]->effective_occupancy[j][nuc];
           }
@@ -1676,7 +2068,7 @@ void Bindings::printModeOccupancy(Gene& gene, ostream& os, bool invert)
   
     os << endl;
   
-    for (int nuc=0; nuc<nnuc; nuc++)
+    for (int nuc=0; nuc<(int) IDs.size(); nuc++)
     {
       string& id = IDs[nuc];
       os << setw(w) << id;
@@ -1699,7 +2091,7 @@ void Bindings::printModeOccupancy(Gene& gene, ostream& os, bool invert)
   else 
   {
     os << setw(w) << "site";
-    for (int nuc=0; nuc<nnuc; nuc++)
+    for (int nuc=0; nuc<(int) IDs.size(); nuc++)
     {
       string& id = IDs[nuc];
       os << setw(w) << id;
@@ -1724,7 +2116,7 @@ void Bindings::printModeOccupancy(Gene& gene, ostream& os, bool invert)
           header += num;
           //header << i;
           os << setw(w) <<  header;
-          for (int nuc=0; nuc<nnuc; nuc++)
+          for (int nuc=0; nuc<(int) IDs.size(); nuc++)
           {
             os << setw(w) << tmp_sites[i]->mode_occupancy[j][nuc];
           }
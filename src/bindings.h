@@ -14,6 +14,7 @@
 #include "chromatin.h"
 #include "bindingsite.h"
 #include "datatable.h"
+#include "indexmap.h"
 
 #include <boost/shared_ptr.hpp>
 
@@ -24,19 +25,19 @@ ensure that subgroups and quenching interactions never point to null. This
 may or may not be what we actually want and should be reconsidered in the
 future */
 
-typedef map<TF*, site_ptr_vector>          gene_sites_map;
+typedef IndexMap<TF, site_ptr_vector>      gene_sites_map;
 typedef boost::shared_ptr<gene_sites_map>  gene_sites_map_ptr;
-typedef map<Gene*, gene_sites_map_ptr>     site_map;
+typedef IndexMap<Gene, gene_sites_map_ptr> site_map;
                                        
-typedef map<TF*, TFscore>                  gene_scores_map;
-typedef boost::shared_ptr<gene_scores_map> gene_scores_map_ptr;
-typedef map<Gene*, gene_scores_map_ptr>    scores_map;
+typedef IndexMap<TF, TFscore>                gene_scores_map;
+typedef boost::shared_ptr<gene_scores_map>   gene_scores_map_ptr;
+typedef IndexMap<Gene, gene_scores_map_ptr>  scores_map;
 
 
 class Bindings
 {
 private:
-  int nnuc;
+  int nnuc; // the nuclei each site holds, all of them unless tiled
   
   genes_ptr     genes;
   tfs_ptr       tfs;
@@ -58,18 +59,36 @@ private:
   site_map sites;                    
   site_map saved_sites;
   
+  IndexMap<Gene, site_pool_ptr> pools; // where the sites of each gene come from
+  
   /* it may be useful at some points to access sites according to their
   order on DNA. I have done that here in the Bindings class so that many
   other classes can get this information if necessary */
-  map<Gene*, vector<BindingSite*> > ordered_sites_f;
-  map<Gene*, vector<BindingSite*> > ordered_sites_r;
+  IndexMap<Gene, vector<BindingSite*> > ordered_sites_f;
+  IndexMap<Gene, vector<BindingSite*> > ordered_sites_r;
 
   void order_sites(Gene&);
+  void order_sites(Gene&, TF&);
+  void rankCandidates(TFscore&);
   void add_to_ordered(Gene& gene, TF& tf);
   void eraseTF(Gene& gene, TF& tf);
   void verify_order(Gene& gene, TF& tf);
   
-  map<TF*, vector<double> > conc;
+  IndexMap<TF, vector<double> > conc;
+  
+  /* when tiled, sites only hold one tile of nuclei at a time. IDs and conc
+  are then the current tile, padded with empty nuclei up to the tile size,
+  and these keep every nucleus */
+  vector<string>                tiled_IDs;
+  IndexMap<TF, vector<double> > tiled_conc;
+  
+  /* the nuclei each tf is present in, as runs of start,end pairs. Outside of
+  them the kv of its sites, and so their occupancy, is 0 */
+  IndexMap<TF, vector<int> > active;
+  unsigned                   activity_version; // bumped whenever active changes
+  
+  void setActive();
+  void sizeGeneMaps(Gene&);
   
   //bool hasScores(Gene&, TF&);
   //bool hasSites(Gene&, TF&);
@@ -93,7 +112,7 @@ public:
   vector<BindingSite*>& getFsites(Gene& gene) { return ordered_sites_f[&gene]; }
   vector<BindingSite*>& getRsites(Gene& gene) { return ordered_sites_r[&gene]; }
   site_ptr_vector& getSites(Gene&, TF&);
-  map<TF*, site_ptr_vector>& getSites(Gene&);
+  gene_sites_map& getSites(Gene&);
   TFscore& getScores(Gene& gene, TF& tf); 
   
   genes_ptr getGenes()  { return genes ; }
@@ -102,7 +121,7 @@ public:
   // Setters
   void setMasterBindingIdx();
   void setGenes(genes_ptr g);
-  void setTFs(tfs_ptr t)             {tfs       = t; }
+  void setTFs(tfs_ptr t);
   void setTFData(table_ptr c)        {tfdata    = c; }
   void setMode(mode_ptr c)           {mode      = c; }
   void setChromatin(chromatin_ptr c) {chromatin = c; }
@@ -153,13 +172,17 @@ public:
   
   // for moving one gene
   void saveScores(Gene&, TF&);
+  void saveScores(Gene&, TF&, const vector<int>& windows);
   void updateScores(Gene&, TF&);
+  void updateScores(Gene&, TF&, const vector<int>& windows);
   void updateScores(Gene&);
   void restoreScores(Gene&, TF&);
   
   void saveSites(Gene&, TF&);
   void updateSites(Gene&, TF&);
+  void updateSites(Gene&, TF&, const vector<int>& windows);
   void updateSites(Gene&);
+  void updateThreshold(Gene&, TF&);
   void restoreSites(Gene&, TF&);
   
   void updateK(Gene&, TF&);
@@ -181,6 +204,12 @@ public:
   void addNuc(string& nuc_id);
   int  getNnuc() {return nnuc; }
   
+  vector<int>& getActive(TF& tf)  { return active[&tf]; }
+  unsigned     getActivityVersion() { return activity_version; }
+  
+  void setTileSize(int size); // after adding nuclei, before creating sites
+  void setTile(int start);
+  
   bool isEqual(Bindings& bindings);
   
   void printSites(ostream& os);
@@ -43,6 +43,60 @@ void printSite(const BindingSite& b, ostream& os)
 
 void printSite(BindingSite* b, ostream& os) { printSite(*b, os); }
 
+
+SitePool::SitePool() : count_size(0) {}
+
+SitePool::~SitePool()
+{
+  int nsites = free_sites.size();
+  for (int i=0; i<nsites; i++)
+    delete free_sites[i];
+  
+  int ncounts = free_counts.size();
+  for (int i=0; i<ncounts; i++)
+    ::operator delete(free_counts[i]);
+}
+
+BindingSite* SitePool::get()
+{
+  if (free_sites.empty())
+    return new BindingSite;
+  
+  BindingSite* b = free_sites.back();
+  free_sites.pop_back();
+  return b;
+}
+
+void SitePool::put(BindingSite* b)
+{
+  free_sites.push_back(b);
+}
+
+void* SitePool::getCount(size_t size)
+{
+  if (count_size == 0)
+    count_size = size;
+  if (size != count_size || free_counts.empty())
+    return ::operator new(size);
+  
+  void* p = free_counts.back();
+  free_counts.pop_back();
+  return p;
+}
+
+void SitePool::putCount(void* p, size_t size)
+{
+  if (size == count_size)
+    free_counts.push_back(p);
+  else
+    ::operator delete(p);
+}
+
+site_ptr newSite(site_pool_ptr pool)
+{
+  return site_ptr(pool->get(), SiteRecycler(pool), SiteCountAllocator<BindingSite>(pool));
+}
+
 /*
 bool compareBindingSiteRight(BindingSite* a, BindingSite* b)
 {
@@ -44,7 +44,7 @@ struct BindingSite
   vector< vector<double> > mode_occupancy;
   vector< vector<double> > effective_occupancy;
   
-  vector<double> saved_kv;
+  // the buffers the current ones are swapped with on save and restore
   vector<double> saved_total_occupancy;
   
   vector< vector<double> > saved_mode_occupancy;
@@ -65,6 +65,65 @@ void printSite(const BindingSite* b, ostream& os);
 typedef boost::shared_ptr<BindingSite> site_ptr;
 typedef vector<site_ptr> site_ptr_vector;
 
+/* Threshold moves create and drop thousands of sites, each holding a dozen 
+vectors. Rather than free them, a site goes back to the pool of its gene when
+the last pointer to it is dropped, and is handed out again with its vectors
+still allocated. The reference count a site_ptr allocates is kept by the pool
+the same way. Sites of a gene are only made and dropped by the thread working
+on that gene, so each gene gets its own pool and no locking is needed */
+class SitePool
+{
+private:
+  vector<BindingSite*> free_sites;
+  vector<void*>        free_counts;
+  size_t               count_size; // every count is the same type
+  
+public:
+  SitePool();
+  ~SitePool();
+  
+  BindingSite* get();
+  void         put(BindingSite*);
+  
+  void* getCount(size_t size);
+  void  putCount(void* p, size_t size);
+};
+
+typedef boost::shared_ptr<SitePool> site_pool_ptr;
+
+// the deleter of pooled sites, it keeps the pool alive as long as its sites
+struct SiteRecycler
+{
+  site_pool_ptr pool;
+  
+  SiteRecycler(site_pool_ptr p) : pool(p) {}
+  void operator()(BindingSite* b) { pool->put(b); }
+};
+
+/* the allocator of the reference counts of pooled sites. A count is freed after
+its deleter is gone, so this keeps the pool alive too */
+template <class T>
+struct SiteCountAllocator
+{
+  typedef T value_type;
+  template <class U> struct rebind { typedef SiteCountAllocator<U> other; };
+  
+  site_pool_ptr pool;
+  
+  SiteCountAllocator(site_pool_ptr p) : pool(p) {}
+  template <class U> SiteCountAllocator(const SiteCountAllocator<U>& a) : pool(a.pool) {}
+  
+  T*   allocate(size_t n)           { return static_cast<T*>(pool->getCount(n*sizeof(T))); }
+  void deallocate(T* p, size_t n)   { pool->putCount(p, n*sizeof(T)); }
+};
+
+template <class T, class U>
+bool operator==(const SiteCountAllocator<T>& a, const SiteCountAllocator<U>& b) { return a.pool == b.pool; }
+template <class T, class U>
+bool operator!=(const SiteCountAllocator<T>& a, const SiteCountAllocator<U>& b) { return a.pool != b.pool; }
+
+site_ptr newSite(site_pool_ptr pool);
+
 
 
 
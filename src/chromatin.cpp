@@ -26,6 +26,8 @@ void Chromatin::read(ptree& parent, genes_ptr g, mode_ptr m)
   genes = g;
   mode  = m;
   
+  accessibility.resize(genes->size());
+  
   if (mode->getChromatin() == false) return;
   
   ptree& chromatin_node = parent.get_child("Chromatin");
@@ -70,18 +72,19 @@ void Chromatin::write(ptree& parent)
   ptree & kacc_node = chromatin_node.add("Kacc","");
   kacc->write(kacc_node, mode->getPrecision());
   
-  typedef map<Gene*, vector<double> >::iterator it_type;
-  
-  for(it_type it=accessibility.begin(); it != accessibility.end(); it++)
+  int ngenes = genes->size();
+  for (int k=0; k<ngenes; k++)
   {
-    Gene& gene = *(it->first);
+    Gene& gene = genes->getGene(k);
+    vector<double>& data = accessibility[&gene];
+    if (data.empty()) continue;
+    
     ptree & gene_node = chromatin_node.add("Gene","");
     
     gene_node.put("<xmlattr>.name", gene.getName());
     
     stringstream tmp;
     tmp.str("");
-    vector<double>& data = it->second;
     int l = data.size();
     //cerr << l << endl;
     //cerr << data[0] << endl;
@@ -15,6 +15,7 @@
 
 #include "gene.h"
 #include "mode.h"
+#include "indexmap.h"
 
 class Chromatin
 {
@@ -24,7 +25,7 @@ private:
   
   double_param_ptr kacc;
   
-  map<Gene*, vector<double> > accessibility;
+  IndexMap<Gene, vector<double> > accessibility;
   
 public:
   Chromatin();
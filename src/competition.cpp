@@ -20,7 +20,9 @@ Competition::Competition():
   threshold(double_param_ptr(new Parameter<double>("CompThreshold","Promoter"))),
   background(double_param_ptr(new Parameter<double>("CompBackground","Promoter"))),
   S(double_param_ptr(new Parameter<double>("S","Promoter"))),
-  interaction_strength(double_param_ptr(new Parameter<double>("InteractionStrength","Promoter")))
+  interaction_strength(double_param_ptr(new Parameter<double>("InteractionStrength","Promoter"))),
+  product(false),
+  distribution(false)
 {}
 
 Competition::Competition(ptree& pt, mode_ptr mode):
@@ -68,6 +70,17 @@ void Competition::getAllParameters(param_ptr_vector& p)
 }
 
 
+/* the most windows a gene of this length can have while Window and Shift stay
+within their limits, or at their values if those lie outside the limits */
+int Competition::getMaxWindows(int length)
+{
+  int max_window = max(window->getValue(), window->getLimHigh());
+  int min_shift  = max(1.0, min(shift->getValue(), shift->getLimLow()));
+  int span       = length + max_window - min_shift;
+  return max(1, span/min_shift + (span % min_shift != 0));
+}
+
+
 /*    Setters   */
 
 
@@ -86,6 +99,8 @@ void Competition::set(ptree& pt, mode_ptr mode)
     interaction_strength->set(1);
     background->set(0);
     S->set(1);
+    product      = false;
+    distribution = false;
   }
   else
   {
@@ -160,6 +175,20 @@ void Competition::set(ptree& pt, mode_ptr mode)
       else
         error("Unrecognized proportionality type " + str);
     }
+    
+    if (competition_node.count("RateModel") == 0)
+      distribution = false;
+    else
+    {
+      ptree& rate_node = competition_node.get_child("RateModel");
+      string str = rate_node.get<string>("<xmlattr>.value", "mean");
+      if (str == string("mean"))
+        distribution = false;
+      else if (str == string("distribution"))
+        distribution = true;
+      else
+        error("Unrecognized rate model " + str + ", must be mean or distribution");
+    }
   }
 }
 
@@ -194,6 +223,12 @@ void Competition::write(ptree& pt)
     nprop_node.put("<xmlattr>.value", "product");
   else
     nprop_node.put("<xmlattr>.value", "sum");
+  
+  ptree& rate_node   = competition_node.add("RateModel        ", "");
+  if (distribution)
+    rate_node.put("<xmlattr>.value", "distribution");
+  else
+    rate_node.put("<xmlattr>.value", "mean");
 }
 
 
@@ -31,6 +31,7 @@ private:
   double_param_ptr interaction_strength;
   
   bool product; // whether T is proportional to the sum or product of Ns
+  bool distribution; // whether R comes from the distribution of bound activators, or from N
   
   
 public:
@@ -48,7 +49,9 @@ public:
   double getBackground()  { return background->getValue();  }
   double getS()           { return S->getValue();           }
   bool   getProduct()     { return product; }
+  bool   getDistribution() { return distribution; }
   double getInteractionStrength() { return interaction_strength->getValue(); }
+  int    getMaxWindows(int length);
   
   // Setters
   void setWindow(double x)      { window->set(x);      }
@@ -58,6 +61,7 @@ public:
   void setBackground(double x)  { background->set(x);  }
   void setS(double x)           { S->set(x);           }
   void setProduct(bool product) { this->product = product; }
+  void setDistribution(bool distribution) { this->distribution = distribution; }
   void setInteractionStrength(double x) { interaction_strength->set(x); }
   
   // I/O
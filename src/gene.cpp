@@ -23,12 +23,14 @@
 
 
 Gene::Gene() :
-  sequence(seq_param_ptr(new Parameter<Sequence>))
+  sequence(seq_param_ptr(new Parameter<Sequence>)),
+  index(0)
 {}
 
 Gene::Gene(string name, string head, int left, int right, int t, promoter_ptr p, scale_factor_ptr s, seq_param_ptr seq, double w) 
 {
   weight      = w;
+  index       = 0;
   gname       = name;
   header      = head;
   right_bound = right;
@@ -37,8 +39,8 @@ Gene::Gene(string name, string head, int left, int right, int t, promoter_ptr p,
   scale       = s;
   tss         = t;
   sequence    = seq;
-  seq->setMove("ResetAll");
-  seq->setRestore("ResetAll");
+  seq->setMove("Sequence");
+  seq->setRestore("Sequence");
 }
 
 
@@ -203,7 +205,11 @@ GeneContainer::GeneContainer(ptree& pt, promoters_ptr p, scale_factors_ptr s)
 
 /*    Setters   */
 
-void GeneContainer::add(gene_ptr gene) { genes.push_back(gene); }
+void GeneContainer::add(gene_ptr gene) 
+{ 
+  gene->setIndex(genes.size());
+  genes.push_back(gene); 
+}
 
 
 /*    Getters   */
@@ -342,7 +348,7 @@ void GeneContainer::readTwoBitGenes(ptree& gene_nodes, string& twobit_name)
 
     gene_ptr tmp(new Gene(gname, header, left_bound, right_bound, tss, promoter, scale, seq, weight));
     tmp->setInclude(include);
-    genes.push_back(tmp);
+    add(tmp);
     string type;
     if (anneal)
       type = "local";
@@ -409,7 +415,7 @@ void GeneContainer::readFastaGenes(ptree& gene_nodes, string& fasta_name)
     
     gene_ptr tmp(new Gene(gname, header, left_bound, right_bound, tss, promoter, scale, seq, weight));
     tmp->setInclude(include);
-    genes.push_back(tmp);
+    add(tmp);
     string type;
     if (anneal)
       type = "local";
@@ -471,7 +477,7 @@ void GeneContainer::readLocalGenes(ptree& gene_nodes)
     
     gene_ptr tmp(new Gene(gname, header, left_bound, right_bound, tss, promoter, scale, seq, weight));
     tmp->setInclude(include);
-    genes.push_back(tmp);
+    add(tmp);
     string type("local");
     gene_map[type]["local"].push_back(tmp);
   }
@@ -48,6 +48,7 @@ private:
   scale_factor_ptr scale;
   bool include;
   double weight; // the weight in the score function
+  int    index;  // which index is this gene within its container?
   
   
 public:
@@ -72,6 +73,7 @@ public:
   void getAllParameters(param_ptr_vector& p);
   seq_param_ptr      getSequenceParam() { return sequence; }
   promoter_ptr       getPromoter()      { return promoter; }
+  int                getIndex()         { return index; }
   
   // setters
   void setWeight(double weight) { this->weight = weight; }
@@ -82,6 +84,7 @@ public:
   void setRightBound(int r);
   void setLeftBound(int l);
   void setInclude(bool include) { this->include = include; }
+  void setIndex(int index)      { this->index   = index;   }
   
   // methods
   
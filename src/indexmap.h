@@ -0,0 +1,48 @@
+/*********************************************************************************
+*                                                                                *
+*     indexmap.h                                                                 *
+*                                                                                *
+*     Per gene or per TF state, stored by the index of the gene or TF            *
+*                                                                                *
+*********************************************************************************/
+
+#ifndef INDEXMAP_H
+#define INDEXMAP_H
+
+#include <vector>
+
+using namespace std;
+
+/* Genes and TFs know their index within their container, so anything we keep
+for each of them can sit in a vector at that index instead of in a map keyed by
+pointer. IndexMap reads just like the map it replaces, state[&gene], but a lookup
+is an offset rather than a walk down a tree.
+
+An entry past the end is default constructed on first use, like a map would,
+which moves the other entries. Whoever owns one should resize it to the number
+of genes or TFs when they are set, so that nothing grows afterwards. Then
+references into it stay valid and threads working on different genes never
+touch the same memory */
+
+template<class K, class V>
+class IndexMap
+{
+private:
+  vector<V> values;
+
+public:
+  V& operator[](K* key)
+  {
+    unsigned i = key->getIndex();
+    if (i >= values.size())
+      values.resize(i+1);
+    return values[i];
+  }
+
+  V&   at(int i)          { return values[i]; }
+  int  size() const       { return values.size(); }
+  void resize(int n)      { values.resize(n); }
+  void clear()            { values.clear(); }
+};
+
+#endif
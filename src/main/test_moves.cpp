@@ -17,9 +17,13 @@
 #include "mode.h"
 #include "utils.h"
 #include <fstream>
+#include <set>
+#include <cfloat>
+#include <cmath>
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/foreach.hpp>
 #include <boost/random/linear_congruential.hpp>
 #include <boost/random/uniform_int.hpp>
 #include <boost/random/uniform_real.hpp>
@@ -38,42 +42,17 @@
 
 #define to_        boost::lexical_cast
 #define to_string_ boost::lexical_cast<string>
+#define foreach_   BOOST_FOREACH
 
 
 using boost::property_tree::ptree;
 
-int main(int argc, char* argv[])
-{
-  /* create my random number generator */
-  boost::minstd_rand baseGen(getpid());
-  boost::uniform_real<> uniDblUnit(0,1);
-  boost::variate_generator<boost::minstd_rand&, boost::uniform_real<> > uniDblGen(baseGen, uniDblUnit);
-  uniDblGen();
-  
+typedef boost::variate_generator<boost::minstd_rand&, boost::uniform_real<> > unif_gen;
 
-  string xmlname(argv[1]);
-  fstream infile(xmlname.c_str());
-  
-  ptree pt;
-  read_xml(infile, pt, boost::property_tree::xml_parser::trim_whitespace);
-  
-  ptree& root_node  = pt.get_child("Root");
-  ptree& mode_node  = root_node.get_child("Mode");
-  ptree& input_node = root_node.get_child("Input");
-  
-  mode_ptr mode(new Mode(xmlname, mode_node));
-  
-  mode->setVerbose(0);
-  for (int i=0; i<10; i++)
-    Organism embryo(input_node, mode);
-  
-  Organism embryo(input_node, mode);
-  
-  unirand48 rnd;
-  //unsigned int seed = mode->getSeed();
-  
-  cerr << endl;
-  
+/* moves every annealed parameter nmoves times and checks that restoring the
+move, ResetAll and Recalculate all agree with the score the move gave */
+void testParams(Organism& embryo, unif_gen& uniDblGen, int nmoves)
+{
   int nparams = embryo.getDimension();
   for (int i=0; i<nparams; i++)
   {
@@ -83,7 +62,7 @@ int main(int argc, char* argv[])
     
     if (param->getType() == "PWM")
     {
-      for (int j=0; j<10; j++)
+      for (int j=0; j<nmoves; j++)
       {
         double rand       = uniDblGen();
         double delta    = 10*rand - 5;
@@ -107,6 +86,7 @@ int main(int argc, char* argv[])
         //cerr << "move: " << move_score << endl;
         //Bindings move_bindings = *(embryo.getBindings());
         embryo.ResetAll();
+        embryo.score();
         double reset_score  = embryo.get_score();
         //cerr << "reset: " << reset_score << endl;
         //Bindings reset_bindings = *(embryo.getBindings());
@@ -129,6 +109,58 @@ int main(int argc, char* argv[])
       }
       cerr << endl;
     }
+    else if (param->getType() == "Sequence")
+    {
+      Parameter<Sequence>* p = dynamic_cast<Parameter<Sequence>* >(param);
+      
+      /* point mutations keep the length, the rest grow or shrink the sequence
+      the way setting it from R does */
+      int deltas[] = {0, 0, 0, 3000, -300, 57, -1, 0, -2000, 1};
+      for (int j=0; j<nmoves; j++)
+      {
+        string bases       = "ACGT";
+        string seq         = p->getValue().getSequenceString();
+        int    len         = seq.size();
+        double start_score = embryo.get_score();
+        
+        if (deltas[j] > 0)
+        {
+          for (int k=0; k<deltas[j]; k++)
+            seq += bases[int(4*uniDblGen())];
+        }
+        else if (deltas[j] < 0)
+          seq = seq.substr(0, max(1, len + deltas[j]));
+        else
+        {
+          for (int k=0; k<5; k++)
+            seq[int(len*uniDblGen())] = bases[int(4*uniDblGen())];
+        }
+        
+        // check to see if restore is working
+        p->set(Sequence(seq));
+        embryo.move(i);
+        embryo.restoreMove(i);
+        if (embryo.get_score() != start_score)
+          error("Starting score was " + to_string_(start_score) + " but restore gave " + to_string_(embryo.get_score()));
+        
+        // check to see that the move gives the same score as reset all and recalculate
+        p->set(Sequence(seq));
+        embryo.move(i);
+        double move_score   = embryo.get_score();
+        embryo.ResetAll();
+        embryo.score();
+        double reset_score  = embryo.get_score();
+        embryo.Recalculate();
+        double recalc_score = embryo.get_score();
+        
+        if (move_score != reset_score)
+          error("Move ("+ to_string_(move_score)+") and ResetAll ("+ to_string_(reset_score)+") gave different answers for a sequence of length " + to_string_(seq.size()) + ". Move generation may be broken");
+        if (reset_score != recalc_score)
+          error("ResetAll ("+ to_string_(reset_score)+") and Recalculate ("+ to_string_(recalc_score)+") gave different answers. ResetAll may be broken");
+        cerr << ".";
+      }
+      cerr << endl;
+    }
     else
     {
       
@@ -139,7 +171,7 @@ int main(int argc, char* argv[])
       double lim_high = p->getLimHigh();
       
       
-      for (int j=0; j<10; j++)
+      for (int j=0; j<nmoves; j++)
       {
         if (param->getType() != string("double")) continue;
         double value    = p->getValue();
@@ -172,6 +204,7 @@ int main(int argc, char* argv[])
         //cerr << "move: " << move_score << endl;
         //Bindings move_bindings = *(embryo.getBindings());
         embryo.ResetAll();
+        embryo.score();
         double reset_score  = embryo.get_score();
         //cerr << "reset: " << reset_score << endl;
         //Bindings reset_bindings = *(embryo.getBindings());
@@ -196,6 +229,211 @@ int main(int argc, char* argv[])
       cerr << endl;
     }
   }
+}
+
+/* anneal every threshold, the first included PWM and the first included
+sequence, which fitted inputs usually hold fixed, so that the site, pwm and
+sequence moves get tested too. Thresholds only rise from their value, since
+lower ones can bind enough sites to overflow the dynamic engine */
+void annealSites(ptree& input_node)
+{
+  bool pwm = false;
+  foreach_(ptree::value_type& tf_node, input_node.get_child("TFs"))
+  {
+    if (tf_node.first != "TF") continue;
+    ptree& tf = tf_node.second;
+    if (!tf.get<bool>("<xmlattr>.include", true)) continue;
+    
+    if (tf.count("threshold"))
+    {
+      ptree& thresh = tf.get_child("threshold");
+      double  value = thresh.get<double>("<xmlattr>.value");
+      thresh.put("<xmlattr>.lim_low",  value);
+      thresh.put("<xmlattr>.lim_high", value + 3);
+      thresh.put("<xmlattr>.anneal",   "true");
+      thresh.put("<xmlattr>.move",     "Sites");
+    }
+    if (!pwm && tf.count("PWM"))
+    {
+      tf.get_child("PWM").put("<xmlattr>.anneal", "true");
+      pwm = true;
+    }
+  }
+  
+  foreach_(ptree::value_type& source_node, input_node.get_child("Genes"))
+  {
+    foreach_(ptree::value_type& gene_node, source_node.second)
+    {
+      if (gene_node.first != "Gene") continue;
+      if (!gene_node.second.get<bool>("<xmlattr>.include", true)) continue;
+      gene_node.second.put("<xmlattr>.anneal", "true");
+      return;
+    }
+  }
+}
+
+/* copies the first few nuclei of the rate data in every table keyed by ID,
+so that compressing nuclei has identical TF profiles to merge */
+void duplicateNuclei(ptree& input_node)
+{
+  set<string> ids;
+  foreach_(ptree::value_type& row, input_node.get_child("RateData"))
+  {
+    if (row.first != "TableRow") continue;
+    ids.insert(row.second.get<string>("<xmlattr>.ID"));
+    if (ids.size() == 5) break;
+  }
+  
+  foreach_(ptree::value_type& table_node, input_node)
+  {
+    if (table_node.second.get<string>("<xmlattr>.row", "") != "ID") continue;
+    
+    vector<ptree> copies;
+    foreach_(ptree::value_type& row, table_node.second)
+    {
+      if (row.first != "TableRow") continue;
+      string id = row.second.get<string>("<xmlattr>.ID");
+      if (ids.count(id) == 0) continue;
+      ptree copy = row.second;
+      copy.put("<xmlattr>.ID", id + "_copy");
+      copies.push_back(copy);
+    }
+    for (unsigned int i=0; i<copies.size(); i++)
+      table_node.second.add_child("TableRow", copies[i]);
+  }
+}
+
+/* builds a new embryo from the annealed input under mode and moves it */
+void testAnnealed(const string& name, ptree& input_node, mode_ptr mode, unif_gen& uniDblGen)
+{
+  cerr << endl << "Testing site, pwm and sequence moves with " << name << endl;
+  mode->setVerbose(0);
+  Organism embryo(input_node, mode);
+  testParams(embryo, uniDblGen, 4);
+}
+
+int main(int argc, char* argv[])
+{
+  /* create my random number generator */
+  boost::minstd_rand baseGen(getpid());
+  boost::uniform_real<> uniDblUnit(0,1);
+  unif_gen uniDblGen(baseGen, uniDblUnit);
+  uniDblGen();
+  
+
+  string xmlname(argv[1]);
+  fstream infile(xmlname.c_str());
+  
+  ptree pt;
+  read_xml(infile, pt, boost::property_tree::xml_parser::trim_whitespace);
+  
+  ptree& root_node  = pt.get_child("Root");
+  ptree& mode_node  = root_node.get_child("Mode");
+  ptree& input_node = root_node.get_child("Input");
+  
+  mode_ptr mode(new Mode(xmlname, mode_node));
+  
+  mode->setVerbose(0);
+  for (int i=0; i<10; i++)
+    Organism embryo(input_node, mode);
+  
+  Organism embryo(input_node, mode);
+  
+  unirand48 rnd;
+  //unsigned int seed = mode->getSeed();
+  
+  cerr << endl;
+  
+  /* the pssm scanner adds up several rows of the matrix per lookup, so its
+  scores can differ from adding them one row at a time, but only by rounding */
+  cerr << "Testing the pssm scanner" << endl;
+  tfs_ptr   tfs   = embryo.getTFs();
+  genes_ptr genes = embryo.getGenes();
+  int ntfs   = tfs->size();
+  int ngenes = genes->size();
+  for (int i=0; i<ntfs; i++)
+  {
+    TF& tf = tfs->getTF(i);
+    if (!tf.getPWM().isPWM()) continue;
+    
+    vector<vector<double> >& mat = tf.getPWM().getPWM();
+    int pwmlen = mat.size();
+    int mdist  = pwmlen - pwmlen/2;
+    for (int j=0; j<ngenes; j++)
+    {
+      vector<int>& seq = genes->getGene(j).getSequence();
+      int     len = seq.size();
+      TFscore t   = tf.score(seq);
+      for (int w=0; w<len; w++)
+      {
+        double f = 0, r = 0, size = 0;
+        for (int k=0; k<pwmlen; k++)
+        {
+          int fpos  = w - mdist + k;
+          int rpos  = w - mdist + pwmlen - 1 - k;
+          int fbase = (fpos < 0 || fpos >= len) ? 4 : seq[fpos];
+          int rbase = (rpos < 0 || rpos >= len) ? 4 : seq[rpos];
+          rbase = (rbase == 4) ? 4 : 3 - rbase;
+          f    += mat[k][fbase];
+          r    += mat[k][rbase];
+          size += fabs(mat[k][fbase]) + fabs(mat[k][rbase]);
+        }
+        double tol = 64*DBL_EPSILON*size;
+        if (fabs(f - t.fscore[w]) > tol || fabs(r - t.rscore[w]) > tol)
+          error("The scanner scored window " + to_string_(w) + " of " + genes->getGene(j).getName() + " for " + tf.getName() + " as " + to_string_(t.fscore[w]) + "," + to_string_(t.rscore[w]) + " rather than " + to_string_(f) + "," + to_string_(r));
+      }
+    }
+    cerr << ".";
+  }
+  cerr << endl;
+  
+  testParams(embryo, uniDblGen, 10);
+  
+  /* the engines take their own shortcuts for site, pwm and sequence moves,
+  so turn those on and check each engine on its own embryo */
+  ptree annealed_node = input_node;
+  annealSites(annealed_node);
+  
+  mode_ptr vectorized(new Mode(xmlname, mode_node));
+  vectorized->setOccupancyMethod("vectorized");
+  testAnnealed("the vectorized engine", annealed_node, vectorized, uniDblGen);
+  
+  mode_ptr dynamic(new Mode(xmlname, mode_node));
+  dynamic->setOccupancyMethod("dynamic");
+  testAnnealed("the dynamic engine", annealed_node, dynamic, uniDblGen);
+  
+  mode_ptr logspace(new Mode(xmlname, mode_node));
+  logspace->setNumerics("log");
+  testAnnealed("log space numerics", annealed_node, logspace, uniDblGen);
+  
+  /* tiles cannot hold the windows competition needs, so tile without it */
+  mode_ptr tiled(new Mode(xmlname, mode_node));
+  tiled->setTileSize(16);
+  tiled->setCompetition(false);
+  testAnnealed("nuclei in tiles of 16", annealed_node, tiled, uniDblGen);
+  
+  mode_ptr competing(new Mode(xmlname, mode_node));
+  competing->setCompetition(true);
+  testAnnealed("promoter competition", annealed_node, competing, uniDblGen);
+  
+  ptree duplicated_node = annealed_node;
+  duplicateNuclei(duplicated_node);
+  
+  mode_ptr compressed(new Mode(xmlname, mode_node));
+  compressed->setCompressNuclei(true);
+  testAnnealed("compressed nuclei", duplicated_node, compressed, uniDblGen);
+  
+  mode_ptr compressed_competing(new Mode(xmlname, mode_node));
+  compressed_competing->setCompressNuclei(true);
+  compressed_competing->setCompetition(true);
+  testAnnealed("compressed nuclei and promoter competition", duplicated_node, compressed_competing, uniDblGen);
+  
+  ptree distribution_node = annealed_node;
+  distribution_node.put("Competition.RateModel.<xmlattr>.value", "distribution");
+  
+  mode_ptr distribution(new Mode(xmlname, mode_node));
+  distribution->setCompetition(true);
+  testAnnealed("the distribution rate model", distribution_node, distribution, uniDblGen);
   
   cerr << endl << "All move functions appear to be working for this problem! Congratulations!" << endl << endl;
 }
@@ -436,7 +436,7 @@ void print_xml(Organism& organism, string& section)
     seq_node.put("", gene.getSequenceString());
     
     ptree& sitelist_node = construct_node.add("BindingSiteList","");
-    map<TF*, site_ptr_vector>& gsites = bindings->getSites(gene);
+    gene_sites_map& gsites = bindings->getSites(gene);
     for (int j=0; j<ntfs; j++)
     {
       TF& tf = tfs->getTF(j);
@@ -539,7 +539,7 @@ void print_f_xml(Organism& organism, string& gname)
   tfs_ptr   tfs   = organism.getTFs();
   
   Gene& gene = genes->getGene(gname);
-  map<TF*, site_ptr_vector>& gsites = bindings->getSites(gene);
+  gene_sites_map& gsites = bindings->getSites(gene);
   
   int ntfs = tfs->size();
   for (int i=0; i<ntfs; i++)
@@ -656,7 +656,7 @@ void print_r_xml(Organism& organism, string& gname)
   tfs_ptr   tfs   = organism.getTFs();
   
   Gene& gene = genes->getGene(gname);
-  map<TF*, site_ptr_vector>& gsites = bindings->getSites(gene);
+  gene_sites_map& gsites = bindings->getSites(gene);
   
   int ntfs = tfs->size();
   for (int i=0; i<ntfs; i++)
@@ -728,7 +728,7 @@ void print_A_xml(Organism& organism, string& gname)
   tfs_ptr   tfs   = organism.getTFs();
   
   Gene& gene = genes->getGene(gname);
-  map<TF*, site_ptr_vector>& gsites = bindings->getSites(gene);
+  gene_sites_map& gsites = bindings->getSites(gene);
   
   int ntfs = tfs->size();
   for (int i=0; i<ntfs; i++)
@@ -818,7 +818,7 @@ void print_F_xml(Organism& organism, string& gname)
   tfs_ptr   tfs   = organism.getTFs();
   
   Gene& gene = genes->getGene(gname);
-  map<TF*, site_ptr_vector>& gsites = bindings->getSites(gene);
+  gene_sites_map& gsites = bindings->getSites(gene);
   
   int ntfs = tfs->size();
   for (int i=0; i<ntfs; i++)
@@ -31,7 +31,8 @@ Mode::Mode()
   min_data         = 1;                 // for functions that divide by data, the minimum to use
   p_thresh         = 0;                 // for using p-value thresholds for pwms
   gc               = 0.5;               // the default gc content to use if unspecified in input
-  occupancy_method = string("dynamic"); // dynamic, combinations, sampling
+  occupancy_method = string("vectorized"); // dynamic or vectorized
+  numerics         = string("auto");    // auto, double, wide, scaled or log
   score_function   = string("sse");     // see, chisq, cc, etc
   scale_data_type  = string("area");    // what function to use when scaling data
   seed_string      = string("1000");    // the seed string in the mode
@@ -50,6 +51,8 @@ Mode::Mode()
  
   seed = 1000; // the seed after processing
   bindingsite_list = 0;
+  tile_size        = 0;                 // hold every nucleus at once
+  compress_nuclei  = false;             // model every nucleus separately
   
   // promoter competition
   competition = false;
@@ -157,7 +160,8 @@ void Mode::read(ptree& pt)
   readNode<int>(     mode_node, string("NumThreads"),        &num_threads,        1                 );
   readNode<int>(     mode_node, string("Schedule"),          &schedule,           LAM               );
   readNode<int>(     mode_node, string("Precision"),         &precision,          DBL_DIG           );
-  readNode<string>(  mode_node, string("OccupancyMethod"),   &occupancy_method,   string("dynamic") );
+  readNode<string>(  mode_node, string("OccupancyMethod"),   &occupancy_method,   string("vectorized"));
+  readNode<string>(  mode_node, string("Numerics"),          &numerics,           string("auto")    );
   readNode<string>(  mode_node, string("ScoreFunction"),     &score_function,     string("sse")     );
   readNode<string>(  mode_node, string("Seed"),              &seed_string,        string("filename"));
   readNode<bool>(    mode_node, string("PerGene"),           &per_gene,           false             );
@@ -171,6 +175,8 @@ void Mode::read(ptree& pt)
   readNode<double>(  mode_node, string("PenaltyWeight"),     &penalty_weight,     0.0               );
   readNode<double>(  mode_node, string("NonSpecificK"),      &non_specific_k,     0.0               );
   readNode<int>(     mode_node, string("BindingSiteList"),   &bindingsite_list,   0                 );
+  readNode<int>(     mode_node, string("TileSize"),          &tile_size,          0                 );
+  readNode<bool>(    mode_node, string("CompressNuclei"),    &compress_nuclei,    false             );
   
   readCompetition(mode_node);
   readScaleData(mode_node);
@@ -193,6 +199,7 @@ void Mode::write(ptree& pt)
   ptree& mode_node = pt.add("Mode", "");
   
   ptree& occupancy_method_node   = mode_node.add("OccupancyMethod  ", "");
+  ptree& numerics_node           = mode_node.add("Numerics         ", "");
   ptree& score_function_node     = mode_node.add("ScoreFunction    ", "");
   ptree& per_gene_node           = mode_node.add("PerGene          ", "");
   ptree& per_nuc_node            = mode_node.add("PerNuc           ", "");
@@ -208,8 +215,11 @@ void Mode::write(ptree& pt)
   ptree& non_specific_k_node     = mode_node.add("NonSpecificK     ", "");
   ptree& chromatin_node          = mode_node.add("Chromatin        ", "");
   ptree& bindingsite_list_node   = mode_node.add("BindingSiteList  ", "");
+  ptree& tile_size_node          = mode_node.add("TileSize         ", "");
+  ptree& compress_nuclei_node    = mode_node.add("CompressNuclei   ", "");
 
   occupancy_method_node.put("<xmlattr>.value", occupancy_method);
+  numerics_node.put("<xmlattr>.value", numerics);
   score_function_node.put("<xmlattr>.value", score_function);
   per_gene_node.put("<xmlattr>.value", per_gene);
   per_nuc_node.put("<xmlattr>.value", per_nuc);
@@ -225,6 +235,8 @@ void Mode::write(ptree& pt)
   non_specific_k_node.put("<xmlattr>.value", non_specific_k);
   chromatin_node.put("<xmlattr>.value", chromatin);
   bindingsite_list_node.put("<xmlattr>.value", bindingsite_list);
+  tile_size_node.put("<xmlattr>.value", tile_size);
+  compress_nuclei_node.put("<xmlattr>.value", compress_nuclei);
 
   writeScaleData(mode_node);
 }
@@ -35,7 +35,8 @@ private:
   double gc;               // the default gc content to use if unspecified in input
   double penalty_weight;   // the weight given to the penalty function
   double non_specific_k;   // the relative energy of nonspecific binding
-  string occupancy_method; // dynamic, combinations, sampling
+  string occupancy_method; // dynamic (reference) or vectorized
+  string numerics;         // auto, double, wide, scaled or log, for vectorized
   string score_function;   // see, chisq, cc, etc
   string scale_data_type;  // what function to use when scaling data
   string seed_string;      // the seed string in the mode
@@ -51,6 +52,8 @@ private:
   int    precision;        // the precision of printed numbers in output
   unsigned int seed;       // the seed after processing
   int bindingsite_list;   // WSB; get BindingSiteList as K or score (default: PWM)
+  int    tile_size;        // nuclei held by binding sites at a time, 0 for all
+  bool   compress_nuclei;  // model nuclei with the same TF concentrations once
   
   // promoter competition
   bool   competition; // whether to use this mode
@@ -74,6 +77,7 @@ public:
   
   // Getters
   string       getOccupancyMethod()    { return occupancy_method;   }
+  string       getNumerics()           { return numerics;           }
   string       getScoreFunction()      { return score_function;     }
   string       getScaleDataType()      { return scale_data_type;    }
   double       getScaleTo()            { return scale_to;           }
@@ -99,9 +103,12 @@ public:
   double       getT()                  { return t;                  }
   unsigned int getSeed()               { return seed;               }
   int          getBindingSiteList()    { return bindingsite_list;   }
+  int          getTileSize()           { return tile_size;          }
+  bool         getCompressNuclei()     { return compress_nuclei;    }
   
   // Setters
   void setOccupancyMethod(string occupancy_method) { this->occupancy_method = occupancy_method;   }
+  void setNumerics(string numerics)                 { this->numerics         = numerics;           }
   void setScoreFunction(string score_function)     { this->score_function   = score_function;     }
   void setScaleDataType(string scale_data_type)    { this->scale_data_type  = scale_data_type;    }
   void setScaleTo(double scale_to)                 { this->scale_to         = scale_to;           }
@@ -125,6 +132,8 @@ public:
   void setT(int t)                                 { this->t                = t;                  }
   void setSeed(unsigned int seed)                  { this->seed             = seed;               }
   void setBindingSiteList(int bindingsite_list)    { this->bindingsite_list = bindingsite_list;   }
+  void setTileSize(int tile_size)                  { this->tile_size        = tile_size;          }
+  void setCompressNuclei(bool compress_nuclei)     { this->compress_nuclei  = compress_nuclei;    }
   
   // I/O
   void read(ptree& pt);
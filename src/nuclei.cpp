@@ -12,9 +12,11 @@
 *********************************************************************************/
 
 #include "nuclei.h"
+#include "vmath.h"
 
 #include <boost/foreach.hpp>
 #include <limits>
+#include <cfloat>
 
 # define foreach_ BOOST_FOREACH
 
@@ -35,6 +37,8 @@ Nuclei::Nuclei(Organism* parent, tfs_ptr t) :
   coeffects(modifying_ptr(new ModifyingInteractions))
 {
   n           = 0;
+  tile_size   = 0;
+  tile_start  = 0;
   tfs         = t;
   genes       = parent->getGenes();
   tfdata      = parent->getTFData();
@@ -56,6 +60,8 @@ Nuclei::Nuclei(Organism* parent, tfs_ptr t) :
 void Nuclei::setParent(Organism* parent)
 {
   n           = 0;
+  tile_size   = 0;
+  tile_start  = 0;
   tfs         = parent->getTFs();
   genes       = parent->getGenes();
   tfdata      = parent->getTFData();
@@ -89,6 +95,7 @@ void Nuclei::setPromoters(promoters_ptr x) {promoters = x;}
 
 void Nuclei::create(ptree& pt)
 {
+  tfs->snapshotCoefs();
   createBindings(pt);
   createSubgroups();
   createCoeffects();
@@ -98,10 +105,12 @@ void Nuclei::create(ptree& pt)
   calcCoeffects();
   calcQuenching();
   calcR();
+  updateTiles();
 }
 
 void Nuclei::create()
 {
+  tfs->snapshotCoefs();
   createBindings();
   createSubgroups();
   createCoeffects();
@@ -111,6 +120,7 @@ void Nuclei::create()
   calcCoeffects();
   calcQuenching();
   calcR();
+  updateTiles();
 }
 
 
@@ -125,6 +135,7 @@ void Nuclei::createBindings(ptree& pt)
   int nids = IDs.size();
   for (int i=0; i<nids; i++)
     bindings->addNuc(IDs[i]);
+  setTiles();
 
   if(mode->getBindingSiteList())
     bindings->createSites(pt);
@@ -146,11 +157,60 @@ void Nuclei::createBindings()
   int nids = IDs.size();
   for (int i=0; i<nids; i++)
     bindings->addNuc(IDs[i]);
+  setTiles();
 
   bindings->createScores();
   bindings->createSites();
 }
 
+void Nuclei::setTiles()
+{
+  tile_start = 0;
+  tile_size  = mode->getTileSize();
+  if (tile_size <= 0 || tile_size >= n)
+  {
+    tile_size = n;
+    return;
+  }
+  if (competition_mode)
+    error("Competition needs every nucleus at once and cannot be used with TileSize");
+  bindings->setTileSize(tile_size);
+}
+
+void Nuclei::setTile(int start)
+{
+  tile_start = start;
+  bindings->setTile(start);
+}
+
+/* kv depends on the concentrations in the tile, so it is recalculated along with
+everything after it. Scores, sites and interactions do not depend on nuclei */
+void Nuclei::calcTiles(bool skip_current)
+{
+  if (tile_size >= n) return;
+  
+  int current = tile_start;
+  int ngenes  = genes->size();
+  
+  for (int start=0; start<n; start+=tile_size)
+  {
+    if (skip_current && start == current) continue;
+    setTile(start);
+    
+    #ifdef PARALLEL
+    #pragma omp parallel for num_threads(mode->getNumThreads())
+    #endif
+    for (int i=0; i<ngenes; i++)
+    {
+      Gene& gene = genes->getGene(i);
+      if (!gene.getInclude()) continue;
+      bindings->updateKandLambda(gene);
+      subgroups->calc_f(gene);
+      evaluate(gene);
+    }
+  }
+}
+
 void Nuclei::createSubgroups()
 {
   subgroups->create(genes, tfs, bindings, mode);
@@ -168,10 +228,32 @@ void Nuclei::createQuenching()
   
 void Nuclei::addNuc(string id)
 {
+  if (mode->getCompressNuclei())
+  {
+    int ntfs = tfs->size();
+    vector<double> profile(ntfs);
+    for (int i=0; i<ntfs; i++)
+      profile[i] = tfdata->getDataPoint("TF", tfs->getTF(i).getName(), "ID", id);
+    
+    map<vector<double>, int>::iterator found = profiles.find(profile);
+    if (found != profiles.end())
+    {
+      id_index[id] = found->second;
+      return;
+    }
+    profiles[profile] = n;
+  }
+  id_index[id] = n;
+  
   IDs.push_back(id);
   n=IDs.size();
   
+  // sized here, so calculating genes in parallel never grows them
   int ngenes = genes->size();
+  penalty.resize(ngenes);
+  Ns.resize(ngenes);
+  Rs.resize(ngenes);
+  competition_map.resize(ngenes);
   
   if (!competition_mode)
   {
@@ -184,32 +266,18 @@ void Nuclei::addNuc(string id)
   }
   else
   {
-    int window = competition->getWindow();
-    int shift  = competition->getShift();
-    
     for (int i=0; i<ngenes; i++)
     {
       Gene& gene = genes->getGene(i);
       Rs[&gene].resize(n);
-      int length = gene.length() + window - shift;
-      competition_data& gcomp = competition_map[&gene];
-      gcomp.nwindows = max(1, length/shift + (length % shift != 0));
-      //cerr << "new window size is " << window << endl;
-      //gcomp.nwindows = length/shift + 2*window/shift - 2;
-      
-      gcomp.N_2D.resize(gcomp.nwindows);
-      gcomp.T_2D.resize(gcomp.nwindows);
-      gcomp.R_2D.resize(gcomp.nwindows);
-      
-      for (int j=0; j<gcomp.nwindows; j++)
-      {
-        gcomp.N_2D[j].resize(n);
-        gcomp.T_2D[j].resize(n);
-        gcomp.R_2D[j].resize(n);
-      }
       
-      gcomp.delta_N.resize(n);
-      gcomp.total_N.resize(n);
+      competition_data& gcomp = competition_map[&gene];
+      int max_windows = competition->getMaxWindows(gene.length());
+      gcomp.N_2D.reserve(max_windows, n);
+      gcomp.T_2D.reserve(max_windows, n);
+      gcomp.R_2D.reserve(max_windows, n);
+      gcomp.P_2D.reserve(max_windows, n);
+      resizeWindow(gene);
     }
   }   
 }
@@ -234,16 +302,12 @@ void Nuclei::resizeWindow(Gene& gene)
   gcomp.nwindows = max(1, length/shift + (length % shift != 0));
   //gcomp.nwindows = length/shift + 2*window/shift - 2;
   
-  gcomp.N_2D.resize(gcomp.nwindows);
-  gcomp.T_2D.resize(gcomp.nwindows);
-  gcomp.R_2D.resize(gcomp.nwindows);
-  
-  for (int j=0; j<gcomp.nwindows; j++)
-  {
-    gcomp.N_2D[j].resize(n);
-    gcomp.T_2D[j].resize(n);
-    gcomp.R_2D[j].resize(n);
-  }
+  gcomp.N_2D.resize(gcomp.nwindows, n);
+  gcomp.T_2D.resize(gcomp.nwindows, n);
+  gcomp.R_2D.resize(gcomp.nwindows, n);
+  gcomp.P_2D.resize(gcomp.nwindows, n);
+  gcomp.rate_key.clear(); // the windows moved, so none of them can be kept
+  gcomp.dists.clear();
 }
 
 /*    Getters   */
@@ -259,14 +323,10 @@ subgroups_ptr Nuclei::getSubgroups()    {return subgroups;}
   
 double& Nuclei::getRate(Gene& gene, string& id)
 {
-  int nids = IDs.size();
-  for (int i=0; i<nids; i++)
-  {
-    if (id == IDs[i])
-    {
-      return Rs[&gene][i];
-    }
-  }
+  map<string, int>::iterator found = id_index.find(id);
+  if (found != id_index.end())
+    return Rs[&gene][found->second];
+  
   stringstream err;
   err << "ERROR: could not find id in this set of nuclei!" << endl;
   error(err.str());
@@ -306,7 +366,14 @@ void Nuclei::calcN(Gene& gene)
 {
   vector<double>& tNs = Ns[&gene];
   tNs.resize(n);
-  for (int i=0; i<n;i++)
+  calcN(gene, 0, min(tile_size, n - tile_start));
+}
+
+// first and last are within the current tile
+void Nuclei::calcN(Gene& gene, int first, int last)
+{
+  double* tNs = &Ns[&gene][tile_start];
+  for (int i=first; i<last;i++)
     tNs[i]=0;
   
   int ntfs = tfs->size();
@@ -317,7 +384,7 @@ void Nuclei::calcN(Gene& gene)
     
     if (tf.neverActivates()) continue;
     
-    vector<double> coefs    = tf.getCoefs();
+    const vector<double>& coefs = tf.getCoefSnapshot();
     site_ptr_vector& tsites = bindings->getSites(gene,tf);
     int ntsites = tsites.size();
     int nmodes  = coefs.size();
@@ -329,7 +396,7 @@ void Nuclei::calcN(Gene& gene)
       for (int k=0; k<ntsites; k++)
       {
         vector<double>& eff_occ = tsites[k]->effective_occupancy[j];
-        for (int l=0; l<n; l++)
+        for (int l=first; l<last; l++)
         {
           tNs[l] += eff_occ[l]*efficiency;
         }
@@ -357,146 +424,163 @@ void Nuclei::calcR(Gene& gene)
   if (!competition_mode)
   {
     calcN(gene);
-    for (int i=0; i<n; i++)
+    int last = tile_start + min(tile_size, n - tile_start);
+    for (int i=tile_start; i<last; i++)
       tRs[i] = gene.getRate(tNs[i]);
   }
   else
     calcR2(gene);
 }
 
+
+/* runs coeffects (if asked), quenching and the rate of a gene over one block of
+nuclei at a time, so the occupancies of a block are still in cache from one stage
+to the next. Competition needs every nucleus before it can slide its windows, so
+it runs the stages one after another */
+#define NUC_BLOCK 64
+
+void Nuclei::evaluate(Gene& gene, bool with_coeffects)
+{
+  if (competition_mode)
+  {
+    if (with_coeffects)
+      coeffects->calc(gene);
+    quenching->calc(gene);
+    calcR(gene);
+    return;
+  }
+  
+  vector<double>& tNs = Ns[&gene];
+  vector<double>& tRs = Rs[&gene];
+  penalty[&gene] = 1.0;
+  tNs.resize(n);
+  
+  int nnuc = min(tile_size, n - tile_start);
+  for (int first=0; first<nnuc; first+=NUC_BLOCK)
+  {
+    int last = min(nnuc, first+NUC_BLOCK);
+    if (with_coeffects)
+      coeffects->calc(gene, first, last);
+    quenching->calc(gene, first, last);
+    calcN(gene, first, last);
+    for (int i=tile_start+first; i<tile_start+last; i++)
+      tRs[i] = gene.getRate(tNs[i]);
+  }
+}
         
 /* THIS FUNCTION WILL ONLY WORK IF EFS TAKE ON VALUES BETWEEN 
 0 AND 1. IF MORE ACTIVATION IS NEEDED USE Q INSTEAD */
-void Nuclei::getRDist(Gene& gene, vector<BindingSite*>& sites, int start_idx, int end_idx, vector<double>& out)
+/* The distribution of the number of bound activators in a window, when every
+activating mode of its sites binds independently. It is built one mode at a
+time by convolving with (1-p, p) in place, from the top down so every count is
+read before it is overwritten. A count is dropped from either end of the
+support once its probability is below RDIST_EPS in every nucleus, so the
+support follows the mean and its spread instead of growing with every site.
+The window keeps only its support, rows lo to hi of n nuclei each */
+void Nuclei::calcRDist(competition_data& gcomp, vector<BindingSite*>& sites, WindowDist& wdist)
 {
-  // make a convenient matrix for holding occupanies and efficiencies
-  // p indexes [site][nuc]
-  vector<vector<double> > p;
-  vector<double>          effs;
-  //cerr << "1" << endl;
-  for (int i = start_idx; i <= end_idx; i++)
+  vector<int>& members = gcomp.members;
+  int nmembers = members.size();
+  
+  int max_count = 0;
+  for (int i=0; i<nmembers; i++)
+    max_count += sites[members[i]]->effective_occupancy.size();
+  
+  vector<double>& dist = gcomp.dist; // dist[count*n + nuc]
+  if ((int) dist.size() < (max_count+1)*n)
+    dist.resize((max_count+1)*n);
+  
+  gcomp.bound.resize(n);
+  double* __restrict__ p = &gcomp.bound[0]; // the probability the mode is bound
+  
+  int lo = 0;
+  int hi = 0;
+  for (int k=0; k<n; k++)
+    dist[k] = 1.0;
+  
+  for (int i=0; i<nmembers; i++)
   {
-    BindingSite& site    = *sites[i];
-    TF& tf               = *site.tf;
-
-    vector<double> coefs = tf.getCoefs();        
-    int nmodes           = coefs.size();
+    BindingSite& site = *sites[members[i]];
+    const vector<double>& coefs = site.tf->getCoefSnapshot();
+    int nmodes = coefs.size();
     for (int j=0; j<nmodes; j++)
     {
       double efficiency = coefs[j];
       if (efficiency <= 0) continue;
-      p.push_back(site.effective_occupancy[j]);
-      int t = p.size() - 1;
+      const double* __restrict__ occ = &site.effective_occupancy[j][0];
+      for (int k=0; k<n; k++)
+        p[k] = occ[k]*efficiency;
+      
+      hi++;
+      double*       __restrict__ top   = &dist[hi*n];
+      const double* __restrict__ below = &dist[(hi-1)*n];
       for (int k=0; k<n; k++)
+        top[k] = below[k]*p[k];
+      for (int c=hi-1; c>lo; c--)
       {
-        p[t][k] *= efficiency;
-        if (p[t][k] < 0) cerr << "efficiency less than 0!" << endl;
-        if (p[t][k] > 1) cerr << "efficiency greater than 1!" << endl;
+        double*       __restrict__ cur  = &dist[c*n];
+        const double* __restrict__ prev = &dist[(c-1)*n];
+        for (int k=0; k<n; k++)
+          cur[k] += (prev[k] - cur[k])*p[k];
+      }
+      double* __restrict__ bottom = &dist[lo*n];
+      for (int k=0; k<n; k++)
+        bottom[k] -= bottom[k]*p[k];
+      
+      // trim the tails
+      while (hi > lo)
+      {
+        const double* row = &dist[hi*n];
+        double row_max = 0;
+        for (int k=0; k<n; k++)
+          row_max = std::max(row_max, row[k]);
+        if (row_max >= RDIST_EPS) break;
+        hi--;
+      }
+      while (lo < hi)
+      {
+        const double* row = &dist[lo*n];
+        double row_max = 0;
+        for (int k=0; k<n; k++)
+          row_max = std::max(row_max, row[k]);
+        if (row_max >= RDIST_EPS) break;
+        lo++;
       }
     }
   }
   
-  //cerr << "2" << endl;
-  
-  vector<vector<double> > n_dist;
-  n_dist.resize(p.size()+1);
-  for (int i=0; i< (int) n_dist.size(); i++)
-    n_dist[i].resize(n);
-  
-  calc_pascal_2D(p, n_dist); 
-  //cerr << "3" << endl;
-  for (int j=0; j<n; j++)
-  {
-    out[j] = 0;
-    double sum = 0;
-    for (int i=0; i< (int) n_dist.size(); i++)
-    {
-      //cerr << n_dist[i][j] << endl;
-      out[j] += n_dist[i][j]*gene.getRate(i);
-      sum += n_dist[i][j];
-    }
-    //cerr << "i:   " << j << endl;
-    //cerr << "sum: " << sum << endl;
-    //cerr << "out: " << out[j] << endl;
-  }
-
-}
-
-void Nuclei::calc_pascal(vector<double> in)
-{
-  int length = in.size() + 1;
-  vector<vector<double> > out;
-  out.resize(length);
-  for (int i=0; i<length; i++)
-    out[i].resize(i+1);
-
-  out[0][0] = 1;
-  for (int i=1; i<length; i++)
-  {
-    vector<double>& outi  = out[i];
-    vector<double>& outi1 = out[i-1];
-    double p = in[i-1];
-    for (int j=0; j<i; j++)
-      outi[j] += outi1[j]*(1-p);
-    for (int j=1; j<=i; j++)
-      outi[j] += outi1[j-1]*p;
-  }
-  
-  for (int i=0; i<length; i++)
-  {
-    
-    for (int j=0; j<=i; j++)
-    {
-      cerr << out[i][j] << " ";
-    }
-    cerr << endl;
-  }
+  wdist.lo = lo;
+  wdist.hi = hi;
+  wdist.rows.assign(dist.begin() + lo*n, dist.begin() + (hi+1)*n);
 }
 
-// in is [site#][nuc]
-void Nuclei::calc_pascal_2D(vector<vector<double> >& in, vector<vector<double> >& ret)
+// the expected rate of a window, the sum over counts c of P(c bound)*rate(c)
+void Nuclei::rateFromRDist(Gene& gene, competition_data& gcomp, WindowDist& wdist, double* out)
 {
-  int length = in.size() + 1;
-  // out is [site#][nuc][row]
-  vector<vector<vector<double> > > out;
-  out.resize(length);
-  for (int i=0; i<length; i++)
-  {
-    out[i].resize(i+1);
-    for (int j=0; j<=i; j++)
-      out[i][j].resize(n);
-  }
-
-  for (int i=0; i<n; i++)
-    out[0][0][i] = 1;
-
-  for (int i=1; i<length; i++)
-  {
-    for (int k=0; k<n; k++)
-    {
-      vector<vector<double> >& outi  = out[i];
-      vector<vector<double> >& outi1 = out[i-1];
-      double p = in[i-1][k];
-      for (int j=0; j<i; j++)
-        outi[j][k] += outi1[j][k]*(1-p);
-      for (int j=1; j<=i; j++)
-        outi[j][k] += outi1[j-1][k]*p;
-    }
-  }
+  // the rate of every count, which only changes with the promoter
+  vector<double>& count_rates = gcomp.count_rates;
+  while ((int) count_rates.size() <= wdist.hi)
+    count_rates.push_back(gene.getRate(count_rates.size()));
   
   for (int k=0; k<n; k++)
+    out[k] = 0;
+  for (int c=wdist.lo; c<=wdist.hi; c++)
   {
-    for (int i=0; i<length; i++)
-    {
-      ret[i][k] = out[length-1][i][k];
-      //cerr << ret[i][k] << " ";
-    }
-    //cerr << endl;
+    const double* __restrict__ row  = &wdist.rows[(c - wdist.lo)*n];
+    double                     rate = count_rates[c];
+    for (int k=0; k<n; k++)
+      out[k] += row[k]*rate;
   }
 }
     
   
 
+/* A window holds the sites whose centers fall in it. Sites enter windows in the
+order of sites_f and leave in the order of sites_r, so the sites in a window are
+a prefix of one less a prefix of the other. Keeping the sum of the efficiency
+weighted occupancy over both prefixes, N of a window is a single difference.
+The rate and the weight of a window only depend on its N and the promoter, so
+they are only recalculated in windows where either changed */
 void Nuclei::calcR2(Gene& gene)
 {
   competition_data& gcomp = competition_map[&gene];
@@ -513,7 +597,56 @@ void Nuclei::calcR2(Gene& gene)
   double S           = competition->getS();
   double interaction_strength = competition->getInteractionStrength();
   
-  int nsites = sites_f.size();
+  int nsites   = sites_f.size();
+  int nwindows = gcomp.nwindows;
+  
+  // what the rate and weight of a window depend on, besides N
+  vector<double> key;
+  key.push_back(specificity);
+  key.push_back(S);
+  key.push_back(interaction_strength);
+  key.push_back(product);
+  map<string, double_param_ptr>& pparams = gene.getPromoter()->getParamMap();
+  for (map<string, double_param_ptr>::iterator it = pparams.begin(); it != pparams.end(); ++it)
+    key.push_back(it->second->getValue());
+  bool fresh = (key != gcomp.rate_key);
+  if (fresh)
+  {
+    gcomp.rate_key = key;
+    gcomp.count_rates.clear();
+  }
+  
+  bool distribution = competition->getDistribution();
+  
+  // the weighted occupancy each site adds to a window, in the order of sites_f
+  vector<double>& weights = gcomp.weights;
+  weights.assign(nsites*n, 0.0);
+  for (int s=0; s<nsites; s++)
+  {
+    BindingSite& site = *sites_f[s];
+    const vector<double>& coefs = site.tf->getCoefSnapshot();
+    int nmodes = coefs.size();
+    double* __restrict__ w = &weights[s*n];
+    for (int j=0; j<nmodes; j++)
+    {
+      double efficiency = coefs[j];
+      if (efficiency <= 0) continue;
+      const double* __restrict__ eff_occ = &site.effective_occupancy[j][0];
+      for (int k=0; k<n; k++)
+        w[k] += eff_occ[k]*efficiency;
+    }
+  }
+  
+  vector<double>& sum_f = gcomp.sum_f; // sum over the sites that entered
+  vector<double>& sum_r = gcomp.sum_r; // sum over the sites that left
+  sum_f.assign(n, 0.0);
+  sum_r.assign(n, 0.0);
+  gcomp.total_N.assign(n, background);
+  
+  double* __restrict__ sf    = &sum_f[0];
+  double* __restrict__ sr    = &sum_r[0];
+  double* __restrict__ total = &gcomp.total_N[0];
+  double  log_S              = log(S);
   
   int prime5 = 0 - window;
   int prime3 = prime5 + window;
@@ -521,125 +654,128 @@ void Nuclei::calcR2(Gene& gene)
   int site_f_idx = 0;
   int site_r_idx = nsites - 1;
   
-  for (int j=0; j<n; j++)
-  {
-    gcomp.delta_N[j] = 0.0;
-    gcomp.total_N[j] = background;
-  }
-    
-  int nwindows = gcomp.nwindows;
+  // which sites have left, when the rate comes from the bound distribution
+  vector<char>& gone = gcomp.gone;
+  int first_in = 0; // no site before this one is still in the window
+  if (distribution)
+    gone.assign(nsites, 0);
   
   for (int i=0; i<nwindows; i++)
   {
-    vector<double>& sub_N = gcomp.N_2D[i];
-    vector<double>& sub_R = gcomp.R_2D[i];
-    vector<double>& sub_T = gcomp.T_2D[i];
+    double* __restrict__ sub_N = gcomp.N_2D[i];
+    double* __restrict__ sub_R = gcomp.R_2D[i];
+    double* __restrict__ sub_P = gcomp.P_2D[i];
     
     prime3 += shift;
     prime5 += shift;
     
     // see what new sites have been added in this window
-    bool in_window = true;
-    
-    while (in_window && site_f_idx < nsites)
+    while (site_f_idx < nsites)
     {
       BindingSite& site = *sites_f[site_f_idx];
-      int pos = (site.m+site.n)/2; 
-      if (pos < prime3)
-      {
-        TF& tf = *site.tf;
-        vector<double> coefs    = tf.getCoefs();                
-        int nmodes  = coefs.size();
-        
-        for (int j=0; j<nmodes; j++)
-        {
-          double efficiency = coefs[j];
-          
-          if (efficiency <= 0) continue;
-          
-          vector<double>& eff_occ = site.effective_occupancy[j];
-          
-          for (int k=0; k<n; k++)
-            gcomp.delta_N[k] +=  eff_occ[k]*efficiency;
-        }
-        site_f_idx++;
-      }
-      else
-        in_window = false;
+      if ((site.m+site.n)/2 >= prime3) break;
+      const double* __restrict__ w = &weights[site_f_idx*n];
+      for (int k=0; k<n; k++)
+        sf[k] += w[k];
+      site_f_idx++;
     }
     
     // see what sites have been removed
-    bool out_window = true;
-    
-    while (out_window && site_r_idx >= 0)
+    while (site_r_idx >= 0)
     {
       BindingSite& site = *sites_r[site_r_idx];
-      int pos = (site.m+site.n)/2; 
-      if (pos < prime5)
-      {
-        TF& tf = *site.tf;
-        vector<double> coefs    = tf.getCoefs();                
-        int nmodes  = coefs.size();
-        
-        for (int j=0; j<nmodes; j++)
-        {
-          double efficiency = coefs[j];
-          
-          if (efficiency <= 0) continue;
-          
-          vector<double>& eff_occ = site.effective_occupancy[j];
-          
-          for (int k=0; k<n; k++)
-            gcomp.delta_N[k] -=  eff_occ[k]*efficiency;
-        }
-        site_r_idx--;
-      }
-      else
-        out_window = false;
+      if ((site.m+site.n)/2 >= prime5) break;
+      const double* __restrict__ w = &weights[site.index_in_ordered_f*n];
+      for (int k=0; k<n; k++)
+        sr[k] += w[k];
+      if (distribution)
+        gone[site.index_in_ordered_f] = 1;
+      site_r_idx--;
+    }
+    
+    if (distribution)
+    {
+      while (first_in < site_f_idx && gone[first_in])
+        first_in++;
     }
-   
-    //cerr << "site_f_idx: " << site_f_idx << endl;
-    //cerr << "site_r_idx: " << site_r_idx << endl;
     
-    //BindingSite& sitef = *sites_f[site_f_idx-1];
-    //BindingSite& sitel = *sites_r[site_r_idx];
-    //int end_idx = sitef.index_in_ordered_f;
-    //int start_idx   = sitel.index_in_ordered_f;
-
-    //cerr << "gene:  " << gene.getName() << endl;
-    //cerr << "start: " << start_idx << " of " << sites_f.size() << endl;
-    //cerr << "end:   " << end_idx   << " of " << sites_f.size() << endl;
-    //getRDist(gene, sites_f, start_idx, end_idx, sub_R);
+    // once every site has left, the difference would only be round off
+    bool empty = (site_f_idx == nsites && site_r_idx < 0);
     
-    if (product)
+    /* the rate function does not vectorize, so it is only called where N moved.
+    The distribution of a window depends on all of its sites, so it is redone
+    if N moved in any nucleus, and only summed again if just the promoter did */
+    bool changed = false;
+    if (!distribution)
     {
-      
-      for (int j=0; j<n;j++)
+      for (int j=0; j<n; j++)
       {
-        double& nj = sub_N[j];
-        nj = gcomp.delta_N[j];
+        double nj = empty ? 0.0 : sf[j] - sr[j];
+        if (!fresh && nj == sub_N[j]) continue;
+        sub_N[j] = nj;
         sub_R[j] = gene.getRate(nj);
-        double p = pow(S, nj);
-        sub_T[j] = p*interaction_strength;
-        gcomp.total_N[j] += p*interaction_strength;
+        changed  = true;
       }
     }
     else
     {
-      for (int j=0; j<n;j++)
+      bool moved = (int) gcomp.dists.size() <= i;
+      for (int j=0; j<n; j++)
       {
-        double& nj = sub_N[j];
-        nj = gcomp.delta_N[j];
-        sub_R[j] = gene.getRate(nj);
-  
-        if ( nj >= threshold )
+        double nj = empty ? 0.0 : sf[j] - sr[j];
+        moved   |= (nj != sub_N[j]);
+        sub_N[j] = nj;
+      }
+      if (moved)
+      {
+        if ((int) gcomp.dists.size() <= i)
+          gcomp.dists.resize(i+1);
+        vector<int>& members = gcomp.members;
+        members.clear();
+        for (int s=first_in; s<site_f_idx; s++)
+          if (!gone[s]) members.push_back(s);
+        calcRDist(gcomp, sites_f, gcomp.dists[i]);
+      }
+      changed = moved || fresh;
+      if (changed)
+        rateFromRDist(gene, gcomp, gcomp.dists[i], sub_R);
+    }
+    
+    if (changed)
+    {
+      if (product)
+      {
+        for (int j=0; j<n; j++)
+          sub_P[j] = vexp(sub_N[j]*log_S)*interaction_strength;
+      }
+      else if (specificity == 1)
+      {
+        for (int j=0; j<n; j++)
+          sub_P[j] = sub_N[j]*interaction_strength;
+      }
+      else
+      {
+        // pow(0, specificity) is 1 for a specificity of 0, and 0 otherwise
+        double p0 = (specificity == 0) ? interaction_strength : 0.0;
+        for (int j=0; j<n; j++)
         {
-          double p = pow(nj, specificity);
-          sub_T[j] = p*interaction_strength;
-          gcomp.total_N[j] += p*interaction_strength;
+          double nj = sub_N[j];
+          double p  = vexp(specificity*vlog(std::max(nj, DBL_MIN)))*interaction_strength;
+          sub_P[j]  = (nj > 0) ? p : p0;
         }
       }
     }
+    
+    if (product)
+    {
+      for (int j=0; j<n; j++)
+        total[j] += sub_P[j];
+    }
+    else
+    {
+      for (int j=0; j<n; j++)
+        total[j] += (sub_N[j] >= threshold) ? sub_P[j] : 0.0;
+    }
   }
   
   vector<double>& tRs = Rs[&gene];
@@ -648,43 +784,16 @@ void Nuclei::calcR2(Gene& gene)
   
   for (int i=0; i<nwindows; i++)
   {
-    vector<double>& sub_N = gcomp.N_2D[i];
-    vector<double>& sub_R = gcomp.R_2D[i];
-    vector<double>& sub_T = gcomp.T_2D[i];
+    const double* __restrict__ sub_N = gcomp.N_2D[i];
+    const double* __restrict__ sub_R = gcomp.R_2D[i];
+    const double* __restrict__ sub_P = gcomp.P_2D[i];
+    double*       __restrict__ sub_T = gcomp.T_2D[i];
     
-    if (product)
+    for (int j=0; j<n;j++)
     {
-      for (int j=0; j<n;j++)
-      {
-        double nj = sub_N[j];
-        if ( nj < threshold )
-        {
-          sub_T[j] = 0.0;
-          tRs[j] += 0.0;
-        }
-        else
-        {
-          sub_T[j] /= gcomp.total_N[j];
-          tRs[j] += sub_R[j] * sub_T[j];
-        }
-      }
-    }
-    else
-    {
-      for (int j=0; j<n;j++)
-      {
-        double nj = sub_N[j];
-        if ( nj < threshold )
-        {
-          sub_T[j] = 0.0;
-          tRs[j] += 0.0;
-        }
-        else
-        {
-          sub_T[j] /= gcomp.total_N[j];
-          tRs[j] += sub_R[j] * sub_T[j];
-        }
-      }
+      double t = (sub_N[j] < threshold) ? 0.0 : sub_P[j]/total[j];
+      sub_T[j] = t;
+      tRs[j]  += sub_R[j]*t;
     }
   }
   
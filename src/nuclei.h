@@ -25,6 +25,7 @@
 #include "mode.h"
 #include "competition.h"
 #include "chromatin.h"
+#include "indexmap.h"
 
 /* For the most part, nuclei does not own the private data inside it. It simply
 points to the data from it's parent class (Organism). The notable exceptions
@@ -32,6 +33,43 @@ are the QuenchingInteractions and Subgroups */
 
 class Organism;
 
+#define RDIST_EPS 1e-15 // the probability below which a count is dropped
+
+/* a value for every window and nucleus of one gene, in a single buffer with the
+nuclei of a window next to each other. That is column major for nuclei by
+windows, as R stores matrices. Space is reserved for the most windows the
+limits of Window and Shift allow, so resizing after a window move does not
+reallocate */
+class WindowMatrix
+{
+private:
+  vector<double> values;
+  int nwindows;
+  int nnuc;
+  
+public:
+  WindowMatrix() : nwindows(0), nnuc(0) {}
+  
+  void reserve(int max_windows, int n) { values.reserve(max_windows*n); }
+  void resize(int windows, int n)      { nwindows = windows; nnuc = n; values.resize(windows*n); }
+  
+  int size() const { return nwindows; } // the number of windows
+  int nuclei() const { return nnuc; }
+  
+  double*       operator[](int window)       { return &values[window*nnuc]; }
+  const double* operator[](int window) const { return &values[window*nnuc]; }
+  const double* data() const { return values.empty() ? NULL : &values[0]; }
+};
+
+/* the probability of every count of bound activators in a window, for the
+counts lo to hi that are not negligible. rows[(count-lo)*n + nuc] */
+struct WindowDist
+{
+  int            lo;
+  int            hi;
+  vector<double> rows;
+};
+
 class Nuclei
 {
 private:
@@ -54,12 +92,23 @@ private:
   modifying_ptr coeffects;
   
   vector<string> IDs;
+  
+  /* every nucleus added and the column it is modeled in. When compressing,
+  nuclei with the same TF concentrations share the column of the first of
+  them, which is the only one in IDs */
+  map<string, int>          id_index;
+  map<vector<double>, int>  profiles;
+  
+  /* bindings hold tile_size nuclei at a time, starting at tile_start. Unless
+  the mode asks for tiles this is every nucleus */
+  int tile_size;
+  int tile_start;
 
-  map<Gene*, double> penalty;
+  IndexMap<Gene, double> penalty;
   
   // if not using promoter competition
-  map<Gene*, vector<double> > Ns;
-  map<Gene*, vector<double> > Rs;
+  IndexMap<Gene, vector<double> > Ns;
+  IndexMap<Gene, vector<double> > Rs;
   
   // if using promoter competition
   bool competition_mode;
@@ -67,17 +116,34 @@ private:
   {
     int nwindows;
     //X_2D[window_number][nuc_number]
-    vector< vector<double> > N_2D;
-    vector< vector<double> > T_2D;
-    vector< vector<double> > R_2D;
-    vector< double> delta_N;
+    WindowMatrix N_2D;
+    WindowMatrix T_2D;
+    WindowMatrix R_2D;
+    WindowMatrix P_2D; // the weight of a window, before normalizing
     vector< double> total_N;
+    
+    vector<double> weights;  // weights[site*n + nuc], sites in the order of sites_f
+    vector<double> sum_f;    // the weights of the sites that entered so far
+    vector<double> sum_r;    // the weights of the sites that left so far
+    vector<double> rate_key; // the parameters R_2D and P_2D were calculated with
+    
+    // for the rate from the distribution of bound activators
+    vector<char>       gone;        // gone[f_index], whether a site has left the windows
+    vector<int>        members;     // the f_index of every site in the current window
+    vector<double>     dist;        // the distribution being built, dist[count*n + nuc]
+    vector<double>     bound;       // the probability a mode is bound, for each nucleus
+    vector<WindowDist> dists;       // the distribution of each window
+    vector<double>     count_rates; // the rate for every count
   };
-  map<Gene*, competition_data> competition_map;
+  IndexMap<Gene, competition_data> competition_map;
   
-  void getRDist(Gene& gene, vector<BindingSite*>& sites, int start_idx, int end_idx, vector<double>& out);
-  void calc_pascal(vector<double>);
-  void calc_pascal_2D(vector<vector<double> >&, vector<vector<double> >& ret);
+  void calcRDist(competition_data& gcomp, vector<BindingSite*>& sites, WindowDist& wdist);
+  void rateFromRDist(Gene& gene, competition_data& gcomp, WindowDist& wdist, double* out);
+  
+  void setTiles();
+  void setTile(int start);
+  void calcTiles(bool skip_current);
+  void warnTiled() { if (tile_size < n) warning("only printing occupancy for the nuclei of the current tile"); }
   
 public:
   // Constructors
@@ -121,10 +187,11 @@ public:
   vector<double>&          getN(Gene& gene)    {return Ns[&gene];}
   double&                  getRate(Gene& gene, string& id);
   vector<string>&          getIDs() {return IDs;}
+  bool                     hasID(string& id) { return id_index.count(id) != 0; }
   
-  vector< vector<double> >& getR2D(Gene& gene)      { return competition_map[&gene].R_2D; }
-  vector< vector<double> >& getN2D(Gene& gene)      { return competition_map[&gene].N_2D; }
-  vector< vector<double> >& getT2D(Gene& gene)      { return competition_map[&gene].T_2D; }
+  WindowMatrix&             getR2D(Gene& gene)      { return competition_map[&gene].R_2D; }
+  WindowMatrix&             getN2D(Gene& gene)      { return competition_map[&gene].N_2D; }
+  WindowMatrix&             getT2D(Gene& gene)      { return competition_map[&gene].T_2D; }
   int                       getNWindows(Gene& gene) { return competition_map[&gene].nwindows; }
   int                       getWindow() { return competition->getWindow(); }
   int                       getShift()  { return competition->getShift();  }
@@ -156,6 +223,7 @@ public:
   void saveCoeffects(Gene& gene)    {coeffects->save(gene);}
   
   void updateSubgroups(Gene& gene)  {subgroups->update(gene);}
+  void updateSubgroups(Gene& gene, TF& tf) {subgroups->update(gene, tf);}
   void updateQuenching(Gene& gene)  {quenching->update(gene);}
   void updateCoeffects(Gene& gene)  {coeffects->update(gene);}
   
@@ -167,11 +235,29 @@ public:
   void calcCoeffects(Gene& gene)    { coeffects->calc(gene);}
   void calcOccupancy(Gene& gene)    { subgroups->calc_f(gene);}
   
+  // only the subgroups with sites of both tf1 and tf2, which may be the same tf
+  void calcOccupancy(Gene& gene, TF& tf1, TF& tf2)    { subgroups->calc_f(gene, tf1, tf2);}
+  void saveOccupancy(Gene& gene, TF& tf1, TF& tf2)    { subgroups->saveOccupancy(gene, tf1, tf2);}
+  void restoreOccupancy(Gene& gene, TF& tf1, TF& tf2) { subgroups->restoreOccupancy(gene, tf1, tf2);}
+  
   //void calcN();
   void calcR();
   void calcN(Gene&);
+  void calcN(Gene&, int first, int last);
   void calcR(Gene&);
   
+  // coeffects, quenching and rate in one pass, which is what most moves end with
+  void evaluate(Gene&, bool with_coeffects=true);
+  
+  /* moves only update the tile currently held, so when tiled the others are
+  recalculated after. A restore also has to redo the current tile, as its saved
+  occupancies were overwritten when the next tile was calculated. So tiling
+  bounds the memory of the sites, not the work: every move and restore redoes
+  kv, occupancy and rates of the other tiles in full, and rates and N are kept
+  for every nucleus rather than reduced from per-tile partial sums */
+  void updateTiles() { calcTiles(true);  }
+  void calcTiles()   { calcTiles(false); }
+  
   void calcR2(Gene&);
   
   void saveSites(TF& tf)           { bindings->saveSites(tf);          }
@@ -185,10 +271,17 @@ public:
   
   void saveSites(Gene& gene, TF& tf)        { bindings->saveSites(gene, tf);        }
   void saveScores(Gene& gene, TF& tf)       { bindings->saveScores(gene, tf);       }
+  void saveScores(Gene& gene, TF& tf, const vector<int>& windows)
+                                            { bindings->saveScores(gene, tf, windows); }
   void updateScores(Gene& gene, TF& tf)     { bindings->updateScores(gene, tf);     }
   void updateScores(Gene& gene)             { bindings->updateScores(gene);         }
+  void updateScores(Gene& gene, TF& tf, const vector<int>& windows)
+                                            { bindings->updateScores(gene, tf, windows); }
   void updateSites(Gene& gene, TF& tf)      { bindings->updateSites(gene, tf);      }
+  void updateSites(Gene& gene, TF& tf, const vector<int>& windows)
+                                            { bindings->updateSites(gene, tf, windows); }
   void updateSites(Gene& gene)              { bindings->updateSites(gene);          }
+  void updateThreshold(Gene& gene, TF& tf)  { bindings->updateThreshold(gene, tf);  }
   void updateK(Gene& gene, TF& tf)          { bindings->updateK(gene, tf);          }
   void updateKandLambda(Gene& gene, TF& tf) { bindings->updateKandLambda(gene, tf); }
   void updateKandLambda(Gene& gene)         { bindings->updateKandLambda(gene);     }
@@ -230,9 +323,10 @@ public:
   // I/O
   void printSubgroups(Gene& g, ostream& os) {subgroups->print(g, os);}
   
-  void printOccupancy(Gene& g, ostream& os, bool invert)          {bindings->printTotalOccupancy(g,os, invert);    }
-  void printModeOccupancy(Gene& g, ostream& os, bool invert)      {bindings->printModeOccupancy(g,os, invert);     }
-  void printEffectiveOccupancy(Gene& g, ostream& os, bool invert) {bindings->printEffectiveOccupancy(g,os, invert);}
+  // when tiled, occupancies are only held for the current tile
+  void printOccupancy(Gene& g, ostream& os, bool invert)          {warnTiled(); bindings->printTotalOccupancy(g,os, invert);    }
+  void printModeOccupancy(Gene& g, ostream& os, bool invert)      {warnTiled(); bindings->printModeOccupancy(g,os, invert);     }
+  void printEffectiveOccupancy(Gene& g, ostream& os, bool invert) {warnTiled(); bindings->printEffectiveOccupancy(g,os, invert);}
   
   void printSites(ostream& os)                     { bindings->printSites(os);}                    
   void printSites(Gene& gene, ostream& os)         { bindings->printSites(gene, os);}             
@@ -234,6 +234,9 @@ void Organism::populate_nuclei(ptree& pt)
 
   nuclei->create(pt);
 
+  if (mode->getCompressNuclei() && mode->getVerbose() >= 1)
+    cerr << nnuc << " nuclei modeled as " << nuclei->size() << " distinct TF profiles" << endl;
+
   if (nnuc == 0)
   {
     stringstream err;
@@ -257,6 +260,9 @@ void Organism::populate_nuclei()
 
   nuclei->create();
 
+  if (mode->getCompressNuclei() && mode->getVerbose() >= 1)
+    cerr << nnuc << " nuclei modeled as " << nuclei->size() << " distinct TF profiles" << endl;
+
   if (nnuc == 0)
   {
     stringstream err;
@@ -268,13 +274,8 @@ void Organism::populate_nuclei()
 
 double* Organism::getPrediction(Gene& gene, string& id)
 {
-  vector<string>& tmp_ids = nuclei->getIDs();
-  int nids = tmp_ids.size();
-  for (int j=0; j<nids; j++)
-  {
-    if (tmp_ids[j] == id)
-      return &(nuclei->getRate(gene, id));
-  }
+  if (nuclei->hasID(id))
+    return &(nuclei->getRate(gene, id));
 
   stringstream err;
   err << "ERROR: could not get prediction for " << gene.getName() << " at " << id << endl;
@@ -395,16 +396,14 @@ void Organism::printRate(ostream& os, bool invert)
       os << setw(w) << master_genes->getGene(i).getName();
     os << endl;
 
-    vector<string>& IDs = nuclei->getIDs();
-    int nids            = IDs.size();
+    int nids = ids.size();
     for (int j=0; j<nids; j++)
     {
-      os << setw(w) << IDs[j];
+      os << setw(w) << ids[j];
       for (int k=0; k<ngenes; k++)
       {
         Gene& gene = master_genes->getGene(k);
-        vector<double>& rate = nuclei->getRate(gene);
-        os << setw(w) << rate[j];
+        os << setw(w) << nuclei->getRate(gene, ids[j]);
       }
       os << endl;
     }
@@ -412,21 +411,17 @@ void Organism::printRate(ostream& os, bool invert)
   else
   {
     os << setw(namew) << setprecision(p) << "id";
-    vector<string>& IDs = nuclei->getIDs();
-    int nids            = IDs.size();
+    int nids = ids.size();
     for (int j=0; j<nids; j++)
-      os << setw(w) << IDs[j];
+      os << setw(w) << ids[j];
     os << endl;
 
     for (int k=0; k<ngenes; k++)
     {
       Gene& gene = master_genes->getGene(k);
       os << setw(namew) << gene.getName();
-      vector<string>& IDs = nuclei->getIDs();
-      int nids         = IDs.size();
-      vector<double>& rate = nuclei->getRate(gene);
       for (int j=0; j<nids; j++)
-        os << setw(w) << rate[j];
+        os << setw(w) << nuclei->getRate(gene, ids[j]);
       os << endl;
     }
   }
@@ -504,11 +499,10 @@ void Organism::printRateData(ostream& os, bool invert)
     }
     os << endl;
 
-    vector<string>& IDs = nuclei->getIDs();
-    int nids         = IDs.size();
+    int nids = ids.size();
     for (int j=0; j<nids; j++)
     {
-      string& id = IDs[j];
+      string& id = ids[j];
       os << setw(w) << id;
       for (int k=0; k<ngenes; k++)
       {
@@ -526,10 +520,9 @@ void Organism::printRateData(ostream& os, bool invert)
   {
     os << setw(namew) << setprecision(p) << "id";
 
-    vector<string>& IDs = nuclei->getIDs();
-    int nids         = IDs.size();
+    int nids = ids.size();
     for (int j=0; j<nids; j++)
-      os << setw(w) << IDs[j];
+      os << setw(w) << ids[j];
 
     os << endl;
 
@@ -540,11 +533,9 @@ void Organism::printRateData(ostream& os, bool invert)
       scale_factor_ptr scale = gene.getScale();
       os << setw(namew) << gene.getName();
 
-      vector<string>& IDs = nuclei->getIDs();
-      int nids         = IDs.size();
       for (int j=0; j<nids; j++)
       {
-        string& id = IDs[j];
+        string& id = ids[j];
         double datapoint = ratedata->getDataPoint("gene",gene.getName(),"ID",id);
         datapoint = scale->scale(datapoint);
         os << setw(w) << datapoint;
@@ -642,10 +633,101 @@ void Organism::setMoves()
   all_moves.clear();
   all_restores.clear();
 
+  setDependencies();
   setPVectorMoves(moves, restores, params);
   setPVectorMoves(all_moves, all_restores, all_params);
   
 }
+
+/* Most parameters only change the genes a TF binds to. Rather than track the 
+whole dependency graph, we keep which genes each TF has sites on, and the moves
+for TF parameters skip the rest */
+void Organism::setDependencies()
+{
+  int ngenes = master_genes->size();
+  int ntfs   = master_tfs->size();
+  
+  // refill existing masks in place, moves may already be bound to them
+  if (!all_genes)
+    all_genes = gene_mask_ptr(new vector<char>);
+  all_genes->assign(ngenes, 1);
+  
+  tf_genes.resize(ntfs);
+  for (int i=0; i<ntfs; i++)
+  {
+    TF& tf = master_tfs->getTF(i);
+    gene_mask_ptr& genes = tf_genes[&tf];
+    if (!genes)
+      genes = gene_mask_ptr(new vector<char>);
+    genes->assign(ngenes, 0);
+    for (int j=0; j<ngenes; j++)
+      updateDependencies(master_genes->getGene(j), j, tf);
+  }
+}
+
+// called from the gene loops, so it only writes to the entry of this gene
+void Organism::updateDependencies(Gene& gene, int gene_idx, TF& tf)
+{
+  vector<char>& genes = *tf_genes[&tf];
+  genes[gene_idx] = (nuclei->getBindings()->getSites(gene, tf).size() > 0);
+}
+
+// the gene whose sequence a parameter is
+Gene& Organism::getSequenceGene(iparam_ptr p)
+{
+  int ngenes = master_genes->size();
+  for (int j=0; j<ngenes; j++)
+  {
+    Gene& gene = master_genes->getGene(j);
+    if (gene.getSequenceParam() == p)
+      return gene;
+  }
+  error("could not find the gene with sequence " + p->getParamName());
+  return master_genes->getGene(0);
+}
+
+// the genes a promoter parameter is used by, all of them if it is not gene specific
+Organism::gene_mask_ptr Organism::getParamGenes(iparam_ptr p)
+{
+  int ngenes = master_genes->size();
+  gene_mask_ptr genes(new vector<char>(ngenes, 0));
+  
+  bool found = false;
+  for (int j=0; j<ngenes; j++)
+  {
+    param_ptr_vector promoter_params;
+    master_genes->getGene(j).getPromoter()->getAllParameters(promoter_params);
+    
+    int nparams = promoter_params.size();
+    for (int k=0; k<nparams; k++)
+    {
+      if (promoter_params[k] == p)
+      {
+        (*genes)[j] = 1;
+        found = true;
+      }
+    }
+  }
+  
+  if (found)
+    return genes;
+  else
+    return all_genes;
+}
+
+// the pair of TFs whose cooperativity p is
+pair<string,string> Organism::getCoopTFs(iparam_ptr p)
+{
+  vector<coop_ptr>& all_coops = coops->getAllCoops();
+  int ncoops = all_coops.size();
+  for (int i=0; i<ncoops; i++)
+  {
+    if (all_coops[i]->getKcoopParam() == p)
+      return all_coops[i]->getTFs();
+  }
+  error("getCoopTFs() could not find the cooperativity for parameter " + p->getParamName());
+  return pair<string,string>();
+}
   
 void Organism::setPVectorMoves(vector<boost::function<void (Organism*)> >& mvec, vector<boost::function<void (Organism*)> >& rvec, param_ptr_vector& pvec)
 {
@@ -673,6 +755,12 @@ void Organism::setPVectorMoves(vector<boost::function<void (Organism*)> >& mvec,
       mvec.push_back(boost::bind(&Organism::moveSites, this, boost::ref(tf)));
       rvec.push_back(boost::bind(&Organism::restoreSites, this, boost::ref(tf)));
     }
+    else if (move == string("Sequence"))
+    {
+      Gene& gene = getSequenceGene(pvec[i]);
+      mvec.push_back(boost::bind(&Organism::moveSequence, this, boost::ref(gene)));
+      rvec.push_back(boost::bind(&Organism::restoreSequence, this, boost::ref(gene)));
+    }
     else if (move == string("Lambda"))
     {
       TF& tf = master_tfs->getTF(pvec[i]->getTFName());
@@ -688,8 +776,9 @@ void Organism::setPVectorMoves(vector<boost::function<void (Organism*)> >& mvec,
     else if (move == string("Coef"))
     {
       double_param_ptr p = boost::dynamic_pointer_cast<Parameter<double> >(pvec[i]);
-      mvec.push_back(boost::bind(&Organism::moveCoef, this, boost::ref(p)));
-      rvec.push_back(boost::bind(&Organism::restoreCoef, this, boost::ref(p)));
+      gene_mask_ptr genes = getTFGenes(master_tfs->getTF(pvec[i]->getTFName()));
+      mvec.push_back(boost::bind(&Organism::moveCoef, this, p, genes));
+      rvec.push_back(boost::bind(&Organism::restoreCoef, this, p, genes));
     }
     else if (move == string("CoopD"))
     {
@@ -698,18 +787,21 @@ void Organism::setPVectorMoves(vector<boost::function<void (Organism*)> >& mvec,
     }
     else if (move == string("Kcoop"))
     {
-      mvec.push_back(boost::bind(&Organism::moveKcoop, this));
-      rvec.push_back(boost::bind(&Organism::restoreKcoop, this));
+      pair<string,string> factors = getCoopTFs(pvec[i]);
+      TF& tf1 = master_tfs->getTF(factors.first);
+      TF& tf2 = master_tfs->getTF(factors.second);
+      mvec.push_back(boost::bind(&Organism::moveKcoop, this, boost::ref(tf1), boost::ref(tf2)));
+      rvec.push_back(boost::bind(&Organism::restoreKcoop, this, boost::ref(tf1), boost::ref(tf2)));
     }
     else if (move == string("Quenching"))
     {
-      mvec.push_back(boost::bind(&Organism::moveQuenching, this));
-      rvec.push_back(boost::bind(&Organism::restoreQuenching, this));
+      mvec.push_back(boost::bind(&Organism::moveQuenching, this, all_genes));
+      rvec.push_back(boost::bind(&Organism::restoreQuenching, this, all_genes));
     }
     else if (move == string("QuenchingCoef"))
     {
-      mvec.push_back(boost::bind(&Organism::moveQuenchingCoef, this));
-      rvec.push_back(boost::bind(&Organism::restoreQuenchingCoef, this));
+      mvec.push_back(boost::bind(&Organism::moveQuenchingCoef, this, all_genes));
+      rvec.push_back(boost::bind(&Organism::restoreQuenchingCoef, this, all_genes));
     }
     else if (move == string("Coeffect"))
     {
@@ -728,8 +820,9 @@ void Organism::setPVectorMoves(vector<boost::function<void (Organism*)> >& mvec,
     }
     else if (move == string("Promoter"))
     {
-      mvec.push_back(boost::bind(&Organism::movePromoter, this));
-      rvec.push_back(boost::bind(&Organism::movePromoter, this));
+      gene_mask_ptr genes = getParamGenes(pvec[i]);
+      mvec.push_back(boost::bind(&Organism::movePromoter, this, genes));
+      rvec.push_back(boost::bind(&Organism::movePromoter, this, genes));
     }
     else if (move == string("Kacc"))
     {
@@ -822,6 +915,8 @@ void Organism::ResetAll()
     cerr << "Reseting everything" << endl;
   
   int ngenes  = master_genes->size();
+  
+  master_tfs->snapshotCoefs();
 
 #ifdef PARALLEL
     #pragma omp parallel for num_threads(mode->getNumThreads())
@@ -845,6 +940,8 @@ void Organism::ResetAll()
     nuclei->updateR(gene);
 
   }
+  nuclei->updateTiles();
+  setDependencies();
 }
 
 /* this will be necessary if something changes the way we score sequence, for instance
@@ -875,14 +972,12 @@ void Organism::moveScores(TF& tf)
 
     nuclei->updateScores(gene,tf);
     nuclei->updateSites(gene,tf);
-    nuclei->updateSubgroups(gene);
+    updateDependencies(gene, j, tf);
+    nuclei->updateSubgroups(gene, tf);
     nuclei->updateCoeffects(gene);
     nuclei->updateQuenching(gene);
     nuclei->calcOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->evaluate(gene);
   }
 }
 
@@ -903,6 +998,7 @@ void Organism::restoreScores(TF& tf)
     if (!gene.getInclude()) continue;
     nuclei->restoreScores(gene,tf);
     nuclei->restoreSites(gene,tf);
+    updateDependencies(gene, j, tf);
     nuclei->restoreAllOccupancy(gene);
     nuclei->restoreSubgroups(gene);
     nuclei->restoreCoeffects(gene);
@@ -943,14 +1039,12 @@ void Organism::movePWM(TF& tf)
 
     nuclei->updateScores(gene,tf);
     nuclei->updateSites(gene,tf);
-    nuclei->updateSubgroups(gene);
+    updateDependencies(gene, j, tf);
+    nuclei->updateSubgroups(gene, tf);
     nuclei->updateCoeffects(gene);
     nuclei->updateQuenching(gene);
     nuclei->calcOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->evaluate(gene);
   }
 
 }
@@ -972,6 +1066,7 @@ void Organism::restorePWM(TF& tf)
     if (!gene.getInclude()) continue;
     nuclei->restoreScores(gene,tf);
     nuclei->restoreSites(gene,tf);
+    updateDependencies(gene, j, tf);
     nuclei->restoreAllOccupancy(gene);
     nuclei->restoreSubgroups(gene);
     nuclei->restoreCoeffects(gene);
@@ -983,8 +1078,104 @@ void Organism::restorePWM(TF& tf)
 }
 
 
+/* a sequence move mutates a few bases of one gene. Only the windows reading a
+mutated base are rescored, and only they can gain or lose sites. A sequence of
+a new length, which can be set from R, changes everything about the gene and
+is reset from scratch */
+void Organism::moveSequence(Gene& gene)
+{
+  if (mode->getVerbose() >= 3)
+    cerr << "Moving sequence of " << gene.getName() << endl;
+  
+  if (!gene.getInclude()) return;
+  
+  // the parameter keeps the sequence before the tweak, so diff against it
+  Sequence     before   = gene.getSequenceParam()->getPrevious();
+  vector<int>& seq      = gene.getSequence();
+  vector<int>& previous = before.getSequence();
+  vector<int>  mutated;
+  int len = seq.size();
+  if (len != (int) previous.size())
+  {
+    ResetAll();
+    return;
+  }
+  for (int i=0; i<len; i++)
+  {
+    if (seq[i] != previous[i])
+      mutated.push_back(i);
+  }
+  
+  nuclei->saveAllOccupancy(gene);
+  nuclei->saveSubgroups(gene);
+  nuclei->saveCoeffects(gene);
+  nuclei->saveQuenching(gene);
+  
+  int j    = gene.getIndex();
+  int ntfs = master_tfs->size();
+  vector<int> windows;
+  for (int i=0; i<ntfs; i++)
+  {
+    TF& tf = master_tfs->getTF(i);
+    tf.getWindows(len, mutated, windows);
+    nuclei->saveSites(gene, tf);
+    if (windows.empty())
+    {
+      nuclei->saveScores(gene, tf);
+      continue;
+    }
+    
+    // only the windows about to be rescored need saving
+    nuclei->saveScores(gene, tf, windows);
+    nuclei->updateScores(gene, tf, windows);
+    nuclei->updateSites(gene, tf, windows);
+    updateDependencies(gene, j, tf);
+    nuclei->updateSubgroups(gene, tf);
+  }
+  
+  nuclei->updateCoeffects(gene);
+  nuclei->updateQuenching(gene);
+  nuclei->calcOccupancy(gene);
+  nuclei->evaluate(gene);
+}
+
+void Organism::restoreSequence(Gene& gene)
+{
+  if (mode->getVerbose() >= 3)
+    cerr << "Restoring sequence of " << gene.getName() << endl;
+  
+  if (!gene.getInclude()) return;
+  
+  int j    = gene.getIndex();
+  int ntfs = master_tfs->size();
+  
+  // the move changed the length and reset everything, so nothing was saved
+  if (ntfs > 0)
+  {
+    TFscore& t = nuclei->getBindings()->getScores(gene, master_tfs->getTF(0));
+    if (t.mscore.size() != gene.getSequence().size())
+    {
+      ResetAll();
+      return;
+    }
+  }
+  
+  for (int i=0; i<ntfs; i++)
+  {
+    TF& tf = master_tfs->getTF(i);
+    nuclei->restoreScores(gene, tf);
+    nuclei->restoreSites(gene, tf);
+    updateDependencies(gene, j, tf);
+  }
+  nuclei->restoreAllOccupancy(gene);
+  nuclei->restoreSubgroups(gene);
+  nuclei->restoreCoeffects(gene);
+  nuclei->restoreQuenching(gene);
+  nuclei->updateR(gene);
+}
+
 /* if thresholds are changed, the sites will need to be repopulated for the tf
-changed */
+changed. Only those between the old and new threshold are added or dropped */
 void Organism::moveSites(TF& tf)
 {
   if (mode->getVerbose() >= 3)
@@ -1006,15 +1197,13 @@ void Organism::moveSites(TF& tf)
     nuclei->saveCoeffects(gene);
     nuclei->saveQuenching(gene);
 
-    nuclei->updateSites(gene,tf);
-    nuclei->updateSubgroups(gene);
+    nuclei->updateThreshold(gene,tf);
+    updateDependencies(gene, j, tf);
+    nuclei->updateSubgroups(gene, tf);
     nuclei->updateCoeffects(gene);
     nuclei->updateQuenching(gene);
     nuclei->calcOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->evaluate(gene);
   }
 
 }
@@ -1035,6 +1224,7 @@ void Organism::restoreSites(TF& tf)
     Gene& gene = master_genes->getGene(j);
     if (!gene.getInclude()) continue;
     nuclei->restoreSites(gene, tf);
+    updateDependencies(gene, j, tf);
     //nuclei->updateSites(gene);
     nuclei->restoreAllOccupancy(gene);
     nuclei->restoreSubgroups(gene);
@@ -1069,10 +1259,7 @@ void Organism::moveCoopD()
 
     nuclei->updateSubgroups(gene);
     nuclei->calcOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->evaluate(gene);
   }
 
 }
@@ -1109,6 +1296,7 @@ void Organism::moveLambda(TF& tf)
     cerr << "Moving lambda" << endl;
 
   int ngenes  = master_genes->size();
+  vector<char>& genes = *getTFGenes(tf);
 
 #ifdef PARALLEL
     #pragma omp parallel for num_threads(mode->getNumThreads())
@@ -1117,15 +1305,13 @@ void Organism::moveLambda(TF& tf)
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
-    nuclei->saveAllOccupancy(gene);
+    if (!gene.getInclude() || !genes[j]) continue;
+    nuclei->saveOccupancy(gene, tf, tf);
+    nuclei->saveModeOccupancy(gene);
     // dont bother saving K and Lambda since that takes nearly as long as calculating
     nuclei->updateKandLambda(gene, tf);
-    nuclei->calcOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->calcOccupancy(gene, tf, tf);
+    nuclei->evaluate(gene);
   }
 
 }
@@ -1136,6 +1322,7 @@ void Organism::restoreLambda(TF& tf)
     cerr << "Restoring lambda" << endl;
 
   int ngenes  = master_genes->size();
+  vector<char>& genes = *getTFGenes(tf);
 
 #ifdef PARALLEL
     #pragma omp parallel for num_threads(mode->getNumThreads())
@@ -1144,8 +1331,9 @@ void Organism::restoreLambda(TF& tf)
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
-    nuclei->restoreAllOccupancy(gene);
+    if (!gene.getInclude() || !genes[j]) continue;
+    nuclei->restoreOccupancy(gene, tf, tf);
+    nuclei->restoreModeOccupancy(gene);
     nuclei->updateKandLambda(gene, tf);
     //nuclei->updateN();
     nuclei->updateR(gene);
@@ -1171,10 +1359,7 @@ void Organism::moveKacc()
     // dont bother saving K and Lambda since that takes nearly as long as calculating
     nuclei->updateKandLambda(gene);
     nuclei->calcOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->evaluate(gene);
   }
 
 }
@@ -1209,6 +1394,7 @@ void Organism::moveKmax(TF& tf)
     cerr << "Moving kmax for tf " << tf.getName() << endl;
 
   int ngenes  = master_genes->size();
+  vector<char>& genes = *getTFGenes(tf);
 
 #ifdef PARALLEL
     #pragma omp parallel for num_threads(mode->getNumThreads())
@@ -1217,14 +1403,12 @@ void Organism::moveKmax(TF& tf)
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
-    nuclei->saveAllOccupancy(gene);
+    if (!gene.getInclude() || !genes[j]) continue;
+    nuclei->saveOccupancy(gene, tf, tf);
+    nuclei->saveModeOccupancy(gene);
     nuclei->updateK(gene, tf);
-    nuclei->calcOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->calcOccupancy(gene, tf, tf);
+    nuclei->evaluate(gene);
   }
 
 }
@@ -1235,6 +1419,7 @@ void Organism::restoreKmax(TF& tf)
     cerr << "Restoring kmax" << endl;
 
   int ngenes  = master_genes->size();
+  vector<char>& genes = *getTFGenes(tf);
 
 #ifdef PARALLEL
     #pragma omp parallel for num_threads(mode->getNumThreads())
@@ -1243,8 +1428,9 @@ void Organism::restoreKmax(TF& tf)
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
-    nuclei->restoreAllOccupancy(gene);
+    if (!gene.getInclude() || !genes[j]) continue;
+    nuclei->restoreOccupancy(gene, tf, tf);
+    nuclei->restoreModeOccupancy(gene);
     nuclei->updateK(gene, tf);
     //nuclei->updateN();
     nuclei->updateR(gene);
@@ -1253,12 +1439,14 @@ void Organism::restoreKmax(TF& tf)
 }
 
 // if we move cooperativity we simply need to redo occupancy calculations
-void Organism::moveKcoop()
+void Organism::moveKcoop(TF& tf1, TF& tf2)
 {
   if (mode->getVerbose() >= 3)
     cerr << "Moving kcoop" << endl;
 
   int ngenes  = master_genes->size();
+  vector<char>& genes1 = *getTFGenes(tf1);
+  vector<char>& genes2 = *getTFGenes(tf2);
 
 #ifdef PARALLEL
     #pragma omp parallel for num_threads(mode->getNumThreads())
@@ -1267,22 +1455,22 @@ void Organism::moveKcoop()
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
-    nuclei->saveAllOccupancy(gene);
-    nuclei->calcOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    if (!gene.getInclude() || !genes1[j] || !genes2[j]) continue;
+    nuclei->saveOccupancy(gene, tf1, tf2);
+    nuclei->saveModeOccupancy(gene);
+    nuclei->calcOccupancy(gene, tf1, tf2);
+    nuclei->evaluate(gene);
   }
 }
 
-void Organism::restoreKcoop()
+void Organism::restoreKcoop(TF& tf1, TF& tf2)
 {
   if (mode->getVerbose() >= 3)
     cerr << "Restoring kcoop" << endl;
 
   int ngenes  = master_genes->size();
+  vector<char>& genes1 = *getTFGenes(tf1);
+  vector<char>& genes2 = *getTFGenes(tf2);
 
 #ifdef PARALLEL
     #pragma omp parallel for num_threads(mode->getNumThreads())
@@ -1291,8 +1479,9 @@ void Organism::restoreKcoop()
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
-    nuclei->restoreAllOccupancy(gene);
+    if (!gene.getInclude() || !genes1[j] || !genes2[j]) continue;
+    nuclei->restoreOccupancy(gene, tf1, tf2);
+    nuclei->restoreModeOccupancy(gene);
     //nuclei->updateN();
     nuclei->updateR(gene);
   }
@@ -1320,10 +1509,7 @@ void Organism::moveCoeffect()
 
     nuclei->updateCoeffects(gene);
     nuclei->updateQuenching(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->evaluate(gene);
   }
 }
 
@@ -1353,7 +1539,7 @@ void Organism::restoreCoeffect()
 /* If we allow a coefficient to switch from activator to repressor, we use this
 function. If the bounds dont allow this, you can simply point the move generator
 to move quenching or move activations */
-void Organism::moveCoef(double_param_ptr p)
+void Organism::moveCoef(double_param_ptr p, gene_mask_ptr genes)
 {
   if (mode->getVerbose() >= 3)
     cerr << "Moving TF coefficient" << endl;
@@ -1362,28 +1548,28 @@ void Organism::moveCoef(double_param_ptr p)
   prev = p->getPrevious();
   
   if ( val >= 0 && prev >= 0)
-    movePromoter();
+    movePromoter(genes);
   else if ( val <= 0 && prev <= 0)
-    moveQuenchingCoef();
+    moveQuenchingCoef(genes);
   else
-    moveQuenching();
+    moveQuenching(genes);
 }
 
-void Organism::restoreCoef(double_param_ptr p)
+void Organism::restoreCoef(double_param_ptr p, gene_mask_ptr genes)
 {
   if (mode->getVerbose() >= 3)
     cerr << "Restoring TF coefficient" << endl;
   
   if ( val >= 0 && prev >= 0)
-    movePromoter();
+    movePromoter(genes);
   else if ( val <= 0 && prev <= 0)
-    restoreQuenchingCoef();
+    restoreQuenchingCoef(genes);
   else
-    restoreQuenching();
+    restoreQuenching(genes);
 }
 
 /* These functions are used if a quencher has been added or removed */
-void Organism::moveQuenching()
+void Organism::moveQuenching(gene_mask_ptr genes)
 {
   if (mode->getVerbose() >= 3)
     cerr << "Moving quenching" << endl;
@@ -1397,7 +1583,7 @@ void Organism::moveQuenching()
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
+    if (!gene.getInclude() || !(*genes)[j]) continue;
     nuclei->saveAllOccupancy(gene);
     //nuclei->saveSites(gene, tf);
     //nuclei->saveScores(gene, tf);
@@ -1411,13 +1597,11 @@ void Organism::moveQuenching()
     nuclei->updateCoeffects(gene);
     nuclei->updateQuenching(gene);
     nuclei->calcOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    nuclei->updateR(gene);
+    nuclei->evaluate(gene);
   }
 }
 
-void Organism::restoreQuenching()
+void Organism::restoreQuenching(gene_mask_ptr genes)
 {
   if (mode->getVerbose() >= 3)
     cerr << "Restoring quenching" << endl;
@@ -1431,7 +1615,7 @@ void Organism::restoreQuenching()
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
+    if (!gene.getInclude() || !(*genes)[j]) continue;
     //nuclei->restoreScores(gene,tf);
     //nuclei->restoreSites(gene,tf);
     nuclei->restoreAllOccupancy(gene);
@@ -1445,7 +1629,7 @@ void Organism::restoreQuenching()
 
 
 /* These functions are used if a the number of quenchers is unchanged */
-void Organism::moveQuenchingCoef()
+void Organism::moveQuenchingCoef(gene_mask_ptr genes)
 {
   if (mode->getVerbose() >= 3)
     cerr << "Moving quenching coefficient" << endl;
@@ -1459,15 +1643,13 @@ void Organism::moveQuenchingCoef()
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
+    if (!gene.getInclude() || !(*genes)[j]) continue;
     nuclei->saveEffectiveOccupancy(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->evaluate(gene, false);
   }
 }
 
-void Organism::restoreQuenchingCoef()
+void Organism::restoreQuenchingCoef(gene_mask_ptr genes)
 {
   if (mode->getVerbose() >= 3)
     cerr << "Restoring quenching coefficient" << endl;
@@ -1481,7 +1663,7 @@ void Organism::restoreQuenchingCoef()
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
+    if (!gene.getInclude() || !(*genes)[j]) continue;
     nuclei->restoreEffectiveOccupancy(gene);
     //nuclei->updateN();
     nuclei->updateR(gene);
@@ -1505,10 +1687,7 @@ void Organism::moveCoeffectEff()
     Gene& gene = master_genes->getGene(j);
     if (!gene.getInclude()) continue;
     nuclei->saveModeOccupancy(gene);
-    nuclei->calcCoeffects(gene);
-    nuclei->calcQuenching(gene);
-    //nuclei->updateN();
-    nuclei->updateR(gene);
+    nuclei->evaluate(gene);
   }
 }
 
@@ -1534,7 +1713,7 @@ void Organism::restoreCoeffectEff()
 }
 
 /* if we have moved the promoter properties we simply call this */
-void Organism::movePromoter()
+void Organism::movePromoter(gene_mask_ptr genes)
 {
   if (mode->getVerbose() >= 3)
     cerr << "Moving promoter parameter" << endl;
@@ -1547,7 +1726,7 @@ void Organism::movePromoter()
   for (int j=0; j<ngenes; j++)
   {
     Gene& gene = master_genes->getGene(j);
-    if (!gene.getInclude()) continue;
+    if (!gene.getInclude() || !(*genes)[j]) continue;
     nuclei->updateR(gene);
   }
 }
@@ -1656,7 +1835,9 @@ void   Organism::generateMove(int idx, double theta)
 
   if (!params[idx]->isOutOfBounds())
   {
+    master_tfs->snapshotCoefs();
     moves[idx](this);
+    nuclei->updateTiles();
     score();
   }
   else
@@ -1687,20 +1868,26 @@ void Organism::adjustThresholds(double percent)
   
 void Organism::move(int idx)
 {
+  master_tfs->snapshotCoefs();
   moves[idx](this);
+  nuclei->updateTiles();
   score();
 }
 
 void Organism::move_all(int idx)
 {
   
+  master_tfs->snapshotCoefs();
   all_moves[idx](this);
+  nuclei->updateTiles();
   score();
 }
 
 void Organism::restore_all(int idx)
 {
+  master_tfs->snapshotCoefs();
   all_restores[idx](this);
+  nuclei->calcTiles();
   score();
 }
 
@@ -1710,11 +1897,13 @@ void   Organism::restoreMove(int idx)
     cerr << "restoring move" << endl;
 
   params[idx]->restore();
+  master_tfs->snapshotCoefs();
 
   // we only want to restore a move if it was out of bounds
   if (!params[idx]->isOutOfBounds())
   {
     restores[idx](this);
+    nuclei->calcTiles();
   }
 
   score();
@@ -78,6 +78,20 @@ private:
   vector<boost::function<void (Organism*)> > all_moves;
   vector<boost::function<void (Organism*)> > all_restores; 
   
+  /* the genes a move has to recalculate, mask[gene index]. tf_genes holds the 
+  genes each TF has sites on, and is kept current by the moves that change sites */
+  typedef boost::shared_ptr<vector<char> > gene_mask_ptr;
+  
+  IndexMap<TF, gene_mask_ptr> tf_genes;
+  gene_mask_ptr               all_genes;
+  
+  void setDependencies();
+  void updateDependencies(Gene& gene, int gene_idx, TF& tf);
+  gene_mask_ptr getTFGenes(TF& tf) { return tf_genes[&tf]; }
+  gene_mask_ptr getParamGenes(iparam_ptr p);
+  pair<string,string> getCoopTFs(iparam_ptr p);
+  Gene& getSequenceGene(iparam_ptr p);
+  
   void setPVectorMoves(vector<boost::function<void (Organism*)> >& mvec, vector<boost::function<void (Organism*)> >& rvec, param_ptr_vector& pvec);
   
   // the move functions
@@ -85,17 +99,18 @@ private:
   void moveScores(TF& tf);
   void movePWM(TF& tf);
   void moveSites(TF& tf);
+  void moveSequence(Gene& gene);
   void moveLambda(TF& tf);
   void moveKacc();
   void moveKmax(TF& tf);
   void moveCoopD();
-  void moveKcoop();
-  void moveCoef(double_param_ptr p);
-  void moveQuenching();
-  void moveQuenchingCoef();
+  void moveKcoop(TF& tf1, TF& tf2);
+  void moveCoef(double_param_ptr p, gene_mask_ptr genes);
+  void moveQuenching(gene_mask_ptr genes);
+  void moveQuenchingCoef(gene_mask_ptr genes);
   void moveCoeffect();
   void moveCoeffectEff();
-  void movePromoter();
+  void movePromoter(gene_mask_ptr genes);
   void moveWindow();
   void null_function();  
   
@@ -103,14 +118,15 @@ private:
   void restoreScores(TF& tf);
   void restorePWM(TF& tf);
   void restoreSites(TF& tf);
+  void restoreSequence(Gene& gene);
   void restoreLambda(TF& tf);
   void restoreKacc();
   void restoreKmax(TF& tf);
   void restoreCoopD();
-  void restoreKcoop();
-  void restoreCoef(double_param_ptr p);
-  void restoreQuenching();
-  void restoreQuenchingCoef();
+  void restoreKcoop(TF& tf1, TF& tf2);
+  void restoreCoef(double_param_ptr p, gene_mask_ptr genes);
+  void restoreQuenching(gene_mask_ptr genes);
+  void restoreQuenchingCoef(gene_mask_ptr genes);
   void restoreCoeffect(); 
   void restoreCoeffectEff();   
 
@@ -12,9 +12,9 @@
 #define foreach_ BOOST_FOREACH
 
 PWM::PWM():
-  mat(pwm_param_ptr(new Parameter<vector<vector<double> > >("PWM","ResetAll"))),
-  period(double_param_ptr(new Parameter<double>("Period","ResetAll"))),
-  beta(double_param_ptr(new Parameter<double>("Beta","ResetAll")))
+  mat(pwm_param_ptr(new Parameter<vector<vector<double> > >("PWM","PWM"))),
+  period(double_param_ptr(new Parameter<double>("Period","Scores"))),
+  beta(double_param_ptr(new Parameter<double>("Beta","Scores")))
 {
   // default parameters
   pseudo     = 1.0;
@@ -26,9 +26,9 @@ PWM::PWM():
 }
 
 PWM::PWM(mode_ptr mode):
-  mat(pwm_param_ptr(new Parameter<vector<vector<double> > >("PWM","ResetAll"))),
-  period(double_param_ptr(new Parameter<double>("Period","ResetAll"))),
-  beta(double_param_ptr(new Parameter<double>("Beta","ResetAll")))
+  mat(pwm_param_ptr(new Parameter<vector<vector<double> > >("PWM","PWM"))),
+  period(double_param_ptr(new Parameter<double>("Period","Scores"))),
+  beta(double_param_ptr(new Parameter<double>("Beta","Scores")))
 {
   // default parameters
   pseudo     = 1.0;
@@ -41,9 +41,9 @@ PWM::PWM(mode_ptr mode):
 }
 
 PWM::PWM(vector<vector<double> >& t, int type, mode_ptr mode):
-  mat(pwm_param_ptr(new Parameter<vector<vector<double> > >("PWM","ResetAll"))),
-  period(double_param_ptr(new Parameter<double>("Period","ResetAll"))),
-  beta(double_param_ptr(new Parameter<double>("Beta","ResetAll")))
+  mat(pwm_param_ptr(new Parameter<vector<vector<double> > >("PWM","PWM"))),
+  period(double_param_ptr(new Parameter<double>("Period","Scores"))),
+  beta(double_param_ptr(new Parameter<double>("Beta","Scores")))
 {
   // default parameters
   this->mode = mode;
@@ -722,6 +722,358 @@ double PWM::score_dyad(int first, int second, double position)
       
   
 
+/* Scores PSSMs over the whole sequence at once. The matrix is flattened into
+rows of 5 (A,C,G,T,N) for the forward strand and for the complement, and the
+windows are scored a block at a time, adding matrix rows to every window of
+the block before moving on. The inner loop is then a table lookup over 
+consecutive positions, which compilers can vectorize, and the block stays in
+cache. Because rows are added SCAN_CHUNK at a time, scores can differ from 
+adding them one by one in the last bit. Windows hanging over either end of the 
+sequence see N there, and are scored one at a time, as are windows reading an
+N, since the packed sequence has no room for it. */
+
+#define SCAN_BLOCK 512
+#define SCAN_CHUNK 4                      // the bases added by one lookup
+#define SCAN_CODES (1 << (2*SCAN_CHUNK))  // the k-mers a chunk can read
+
+void PWM::scan(const vector<int>& s, TFscore& t)
+{
+  int len = s.size();
+  t.fscore.resize(len);
+  t.rscore.resize(len);
+  t.mscore.resize(len);
+  scan(s, t, 0, len);
+}
+
+// scores the windows from to to-1, leaving the others alone
+void PWM::scan(const vector<int>& s, TFscore& t, int from, int to)
+{
+  PWMScanner scanner;
+  scanner.add(*this);
+  
+  vector<TFscore*> scores(1, &t);
+  scanner.scan(s, scores, from, to);
+}
+
+void PWMScanner::add(PWM& pwm)
+{
+  vector<vector<double> >& matrix = pwm.getPWM();
+  
+  tables.push_back(PWMTables());
+  PWMTables& tab = tables.back();
+  
+  int pwmlen  = matrix.size();
+  tab.pwmlen  = pwmlen;
+  tab.ndist   = pwmlen/2; // returns floor for middle position
+  tab.mdist   = pwmlen - tab.ndist;
+  tab.nchunks = (pwmlen >= SCAN_CHUNK) ? (pwmlen + SCAN_CHUNK - 1)/SCAN_CHUNK : 0;
+  
+  // ftab[i*5 + base] scores the forward strand, ctab the complement
+  tab.ftab.resize(pwmlen*5);
+  tab.ctab.resize(pwmlen*5);
+  for (int i=0; i<pwmlen; i++)
+  {
+    for (int k=0; k<5; k++)
+    {
+      tab.ftab[i*5 + k] = matrix[i][k];
+      tab.ctab[i*5 + k] = matrix[i][k == 4 ? 4 : 3-k];
+    }
+  }
+  
+  /* fchunk and cchunk hold the summed score of a chunk of rows for every k-mer.
+  Chunk g holds rows SCAN_CHUNK*g on, and reads the k-mer at offset[g] in the
+  window. When the rows do not divide into chunks, the last one reads the last
+  k-mer of the window and only scores the rows no other chunk did. The reverse
+  strand reads the mirrored k-mer backwards */
+  tab.offset.resize(tab.nchunks);
+  tab.fchunk.assign(tab.nchunks*SCAN_CODES, 0.0);
+  tab.cchunk.assign(tab.nchunks*SCAN_CODES, 0.0);
+  for (int g=0; g<tab.nchunks; g++)
+  {
+    int lo  = SCAN_CHUNK*g;
+    int hi  = min(pwmlen, lo + SCAN_CHUNK);
+    int off = min(lo, pwmlen - SCAN_CHUNK);
+    tab.offset[g] = off;
+    
+    double* frow = &tab.fchunk[g*SCAN_CODES];
+    double* crow = &tab.cchunk[g*SCAN_CODES];
+    for (int c=0; c<SCAN_CODES; c++)
+    {
+      for (int j=0; j<SCAN_CHUNK; j++)
+      {
+        int base = (c >> 2*(SCAN_CHUNK-1-j)) & 3;
+        int frow_i = off + j;
+        int crow_i = off + SCAN_CHUNK-1-j;
+        if (frow_i >= lo && frow_i < hi)
+          frow[c] += tab.ftab[frow_i*5 + base];
+        if (crow_i >= lo && crow_i < hi)
+          crow[c] += tab.ctab[crow_i*5 + base];
+      }
+    }
+  }
+}
+
+// the windows first to last-1, all of which lie in the sequence and read no N
+static void scanChunks(PWMTables& tab, const unsigned char* code, int cbase,
+                       const int* seq, int first, int last, TFscore& t)
+{
+  int pwmlen  = tab.pwmlen;
+  int nchunks = tab.nchunks;
+  
+  double* fscore = t.fscore.data();
+  double* rscore = t.rscore.data();
+  double* mscore = t.mscore.data();
+  
+  for (int b=first; b<last; b+=SCAN_BLOCK)
+  {
+    int nwin = min(SCAN_BLOCK, last - b);
+    double f[SCAN_BLOCK];
+    double r[SCAN_BLOCK];
+    for (int w=0; w<nwin; w++)
+    {
+      f[w] = 0.0;
+      r[w] = 0.0;
+    }
+    
+    int start = b - tab.mdist; // the first base of the first window
+    for (int g=0; g<nchunks; g++)
+    {
+      const double*        frow = &tab.fchunk[g*SCAN_CODES];
+      const double*        crow = &tab.cchunk[g*SCAN_CODES];
+      const unsigned char* fseq = code + start - cbase + tab.offset[g];
+      const unsigned char* rseq = code + start - cbase + pwmlen - SCAN_CHUNK - tab.offset[g];
+      for (int w=0; w<nwin; w++)
+      {
+        f[w] += frow[fseq[w]];
+        r[w] += crow[rseq[w]];
+      }
+    }
+    
+    // too short for a chunk
+    for (int i=(nchunks ? pwmlen : 0); i<pwmlen; i++)
+    {
+      const double* frow = &tab.ftab[i*5];
+      const double* crow = &tab.ctab[i*5];
+      const int*    fseq = seq + start + i;
+      const int*    rseq = seq + start + pwmlen - 1 - i;
+      for (int w=0; w<nwin; w++)
+      {
+        f[w] += frow[fseq[w]];
+        r[w] += crow[rseq[w]];
+      }
+    }
+    
+    for (int w=0; w<nwin; w++)
+    {
+      fscore[b+w] = f[w];
+      rscore[b+w] = r[w];
+      mscore[b+w] = max(f[w], r[w]);
+    }
+  }
+}
+
+// one window at a time, a row at a time, seeing N off the ends
+static void scanWindow(PWMTables& tab, const int* seq, int len, int w, TFscore& t)
+{
+  int pwmlen = tab.pwmlen;
+  int start  = w - tab.mdist;
+  double f = 0.0;
+  double r = 0.0;
+  for (int i=0; i<pwmlen; i++)
+  {
+    int fpos = start + i;
+    int rpos = start + pwmlen - 1 - i;
+    int fbase = (fpos < 0 || fpos >= len) ? 4 : seq[fpos];
+    int rbase = (rpos < 0 || rpos >= len) ? 4 : seq[rpos];
+    f += tab.ftab[i*5 + fbase];
+    r += tab.ctab[i*5 + rbase];
+  }
+  t.fscore[w] = f;
+  t.rscore[w] = r;
+  t.mscore[w] = max(f, r);
+}
+
+/* Every block of windows is scored for each pssm in turn, so the sequence is 
+read once, and packed once, for all of them */
+void PWMScanner::scan(const vector<int>& s, vector<TFscore*>& scores, int from, int to)
+{
+  int len    = s.size();
+  int ntabs  = tables.size();
+  const int* seq = s.data();
+  
+  from = max(0, from);
+  to   = min(len, to);
+  if (from >= to || ntabs == 0) return;
+  
+  int maxlen = 0;
+  for (int k=0; k<ntabs; k++)
+    maxlen = max(maxlen, tables[k].pwmlen);
+  
+  /* the bases any window from from to to-1 reads. code[p] packs the SCAN_CHUNK
+  bases from p two bits each, and nprefix[p] counts the Ns before p. Both are
+  offset by pfirst */
+  int pfirst = max(0, from - maxlen);
+  int plast  = min(len, to + maxlen);
+  int npos   = plast - pfirst;
+  
+  code.assign(npos, 0);
+  nprefix.resize(npos + 1);
+  nprefix[0] = 0;
+  unsigned packed = 0;
+  for (int p=pfirst; p<plast; p++)
+  {
+    int base = seq[p];
+    nprefix[p - pfirst + 1] = nprefix[p - pfirst] + (base == 4);
+    packed = ((packed << 2) | (base & 3)) & (SCAN_CODES - 1);
+    if (p - pfirst >= SCAN_CHUNK - 1)
+      code[p - pfirst - SCAN_CHUNK + 1] = packed;
+  }
+  for (int b=from; b<to; b+=SCAN_BLOCK)
+  {
+    int bend = min(to, b + SCAN_BLOCK);
+    for (int k=0; k<ntabs; k++)
+    {
+      PWMTables& tab = tables[k];
+      int first = max(b, min(tab.mdist, len));
+      int last  = min(bend, len - tab.ndist + 1);
+      if (first < last)
+        scanChunks(tab, code.data(), pfirst, seq, first, last, *scores[k]);
+    }
+  }
+  
+  // the windows at the ends, and any reading an N
+  bool hasN = (nprefix[npos] > 0);
+  for (int k=0; k<ntabs; k++)
+  {
+    PWMTables& tab = tables[k];
+    TFscore&   t   = *scores[k];
+    int first = max(from, min(tab.mdist, len));
+    int last  = max(first, min(to, len - tab.ndist + 1));
+    
+    for (int w=from; w<min(to, first); w++)
+      scanWindow(tab, seq, len, w, t);
+    for (int w=max(from, last); w<to; w++)
+      scanWindow(tab, seq, len, w, t);
+    
+    if (!hasN) continue;
+    for (int w=first; w<last; w++)
+    {
+      int start = w - tab.mdist - pfirst;
+      if (nprefix[start + tab.pwmlen] > nprefix[start])
+        scanWindow(tab, seq, len, w, t);
+    }
+  }
+}
+
+/* The periodic score of a window sums a term for each of its dinucleotides,
+which only depends on the dinucleotide and its offset from the dyad. So the
+terms are tabulated for every offset, and only computed again when the period
+or beta move. periodic_f[p*25 + first*5 + second] is the term for the
+dinucleotide starting p into the window on the forward strand, periodic_r the
+one read from the complement. They are the terms subscore adds */
+void PWM::tabulate()
+{
+  int    size     = plength;
+  double halfsize = (double) (size - 1) / 2.0; // the position of the dyad
+  
+  periodic_f.resize((size-1)*25);
+  periodic_r.resize((size-1)*25);
+  for (int p=0; p<size-1; p++)
+  {
+    for (int first=0; first<5; first++)
+    {
+      for (int second=0; second<5; second++)
+      {
+        int cfirst  = (first  == 4) ? 4 : 3 - first;
+        int csecond = (second == 4) ? 4 : 3 - second;
+        periodic_f[p*25 + first*5 + second] = log(score_dyad(first, second, (p+1) - halfsize)/0.25);
+        periodic_r[p*25 + first*5 + second] = log(score_dyad(cfirst, csecond, p - halfsize)/0.25);
+      }
+    }
+  }
+  
+  table_period = period->getValue();
+  table_beta   = beta->getValue();
+}
+
+/* Scores a periodic model over the windows from to to-1 from its tables, a
+block of windows at a time like scan. A term depends on where in the window
+its dinucleotide falls, so a window cannot be had from the last one by adding
+the dinucleotide entering and dropping the one leaving. The terms are added
+in the same order as subscore adds them, and the scores are the same */
+void PWM::scanPeriodic(const vector<int>& s, TFscore& t, int from, int to)
+{
+  // genes are scored in parallel, the first to see a new period or beta retabulates
+#ifdef PARALLEL
+  #pragma omp critical(periodic_tables)
+#endif
+  {
+    if (periodic_f.empty() || table_period != period->getValue() || table_beta != beta->getValue())
+      tabulate();
+  }
+  
+  int size  = plength;
+  int ndist = size/2; // returns floor for middle position
+  int mdist = size-ndist;
+  int len   = s.size();
+  
+  from = max(0, from);
+  to   = min(len, to);
+  if (from >= to) return;
+  
+  /* the dinucleotides the windows read, N off the ends, coded first*5 + second.
+  dinuc[q] starts at base pfirst + q */
+  int pfirst = from - mdist;
+  int npairs = (to - from) + size - 2;
+  vector<unsigned char> dinuc(npairs);
+  const int* seq = s.data();
+  for (int q=0; q<npairs; q++)
+  {
+    int p = pfirst + q;
+    int first  = (p   < 0 || p   >= len) ? 4 : seq[p];
+    int second = (p+1 < 0 || p+1 >= len) ? 4 : seq[p+1];
+    dinuc[q] = first*5 + second;
+  }
+  
+  double* fscore = t.fscore.data();
+  double* rscore = t.rscore.data();
+  double* mscore = t.mscore.data();
+  
+  for (int b=from; b<to; b+=SCAN_BLOCK)
+  {
+    int nwin = min(SCAN_BLOCK, to - b);
+    double f[SCAN_BLOCK];
+    double r[SCAN_BLOCK];
+    for (int w=0; w<nwin; w++)
+    {
+      f[w] = 0.0;
+      r[w] = 0.0;
+    }
+    
+    // subscore adds the forward terms from the left, the reverse from the right
+    const unsigned char* pairs = &dinuc[b - from];
+    for (int k=0; k<size-1; k++)
+    {
+      const double*        frow = &periodic_f[k*25];
+      const double*        rrow = &periodic_r[(size-2-k)*25];
+      const unsigned char* fseq = pairs + k;
+      const unsigned char* rseq = pairs + size-2-k;
+      for (int w=0; w<nwin; w++)
+      {
+        f[w] += frow[fseq[w]];
+        r[w] += rrow[rseq[w]];
+      }
+    }
+    
+    for (int w=0; w<nwin; w++)
+    {
+      fscore[b+w] = f[w];
+      rscore[b+w] = r[w];
+      mscore[b+w] = max(f[w], r[w]);
+    }
+  }
+}
+
 void PWM::score(const vector<int>& s, TFscore &t)
 {
   /* I do something a little unorthodox here. I want to control for boundary
@@ -730,57 +1082,60 @@ void PWM::score(const vector<int>& s, TFscore &t)
   middle of the binding site rather than the m position. This means my output is
   of the same length as the sequence and it is the same length for every factor */
   
-  int i, j, k;
-  int mdist, ndist;
-  int start, end;
-  int len;
-  int pwmlen;
+  int len = s.size();
+  t.fscore.resize(len);
+  t.rscore.resize(len);
+  t.mscore.resize(len);
+  t.ranked.clear();
+  //t.tfname = tfname;
   
+  score(s, t, 0, len);
+}
+
+// scores the windows from to to-1 of s, t already holds a score for all of s
+void PWM::score(const vector<int>& s, TFscore& t, int from, int to)
+{
   if (is_pwm)
-  {
-    vector<vector<double> >& matrix = mat->getValue();
-    pwmlen = matrix.size();
-  }
+    scan(s, t, from, to);
   else if (is_periodic)
-    pwmlen = plength;
+    scanPeriodic(s, t, from, to);
   else
     error("unrecognized pwm type in score");
-    
-    
-  vector<int> sub(pwmlen);
-  ndist = pwmlen/2; // returns floor for middle position
-  mdist = pwmlen-ndist;
-  
-  double * out = new double[3];
-  len = s.size();
+}
 
-  t.fscore.resize(len);
-  t.rscore.resize(len);
-  t.mscore.resize(len);
-  //t.tfname = tfname;
+/* After the bases at mutated (in order) changed, only the windows that read one
+of them change score. Those are returned in windows as runs of start,end pairs */
+void PWM::getWindows(int len, const vector<int>& mutated, vector<int>& windows)
+{
+  int pwmlen = is_pwm ? (int) mat->getValue().size() : (int) plength;
+  int ndist  = pwmlen/2;
+  int mdist  = pwmlen-ndist;
   
-  for (i=0; i<len; i++)
+  windows.clear();
+  int nmutated = mutated.size();
+  for (int i=0; i<nmutated; i++)
   {
-    start = i - mdist;
-    end   = i + ndist;
-    // j = index in s
-    // j = index in pwm
-    for (j=start, k=0; j<end; j++, k++)
+    int start = max(0, mutated[i] - ndist + 1);
+    int end   = min(len, mutated[i] + mdist + 1);
+    if (start >= end) continue;
+    if (!windows.empty() && start <= windows.back())
+      windows.back() = max(windows.back(), end);
+    else
     {
-      if (j<0 || j>=len)
-      {
-        sub[k]=4;
-      } else 
-      {
-        sub[k]=s[j];
-      }
+      windows.push_back(start);
+      windows.push_back(end);
     }
-    subscore(sub,out);
-    t.fscore[i] = out[0];
-    t.rscore[i] = out[1];
-    t.mscore[i] = out[2];
-  } 
-  delete[] out;
+  }
+}
+
+// rescore only the runs of windows from getWindows
+void PWM::rescore(const vector<int>& s, TFscore& t, const vector<int>& windows)
+{
+  int nruns = windows.size();
+  for (int r=0; r<nruns; r+=2)
+    score(s, t, windows[r], windows[r+1]);
+  
+  t.ranked.clear();
 }
 
 //size_t PWM::getSize()
@@ -53,6 +53,13 @@ struct TFscore
   vector<double> rscore;
   vector<double> mscore;
   double maxscore;
+  
+  /* the candidate sites, 2*position plus 1 if reverse, from best to worst.
+  Bindings fills it when a threshold moves, scoring leaves it empty */
+  vector<int> ranked;
+  
+  // in a saved copy, the runs of windows it holds. Empty if it holds them all
+  vector<int> windows;
 };
 
 class PWM
@@ -77,12 +84,20 @@ private:
   double                  plength;     // the length of sequence to scan over (use 147 or 146 for octamer, 74 for tetramer)
   double_param_ptr        period;      // the period of dinuc (10-11)
   double_param_ptr        beta;        // the strengh of preference for dinucs
+  vector<double>          periodic_f;  // the score of each dinuc at each offset, see tabulate
+  vector<double>          periodic_r;
+  double                  table_period; // the period and beta they were tabulated for
+  double                  table_beta;
   
   double maxscore; // the maximum score
 
   // private methods
   void subscore(const vector<int> & s, double * out);
+  void scan(const vector<int>& s, TFscore& t); // scores a pssm over all of s
+  void scan(const vector<int>& s, TFscore& t, int from, int to);
   double score_dyad(int first, int second, double position);
+  void tabulate();
+  void scanPeriodic(const vector<int>& s, TFscore& t, int from, int to);
   
 public:
   // constructors
@@ -109,6 +124,7 @@ public:
                         { maxscore = mscore; } // WSB
   int    length()       { return mat->getValue().size(); }
   int    getInputType() { return input_type; }
+  bool   isPWM()        { return is_pwm; }
   vector<int>& getConsensus() { return consensus; }
   vector<vector<double> >& getPWM(); // efficient, return reference to pwm
   vector<vector<double> >  getPWM(int type); // return a copy, for conveneince, not inner loop
@@ -130,6 +146,9 @@ public:
   double pval2score(double pval);  // returns the threshold that would yeild a given p-value
   double score2pval(double score); // returns the pvalue of a given score
   void   score(const vector<int>& s, TFscore &t);
+  void   score(const vector<int>& s, TFscore &t, int from, int to);
+  void   getWindows(int len, const vector<int>& mutated, vector<int>& windows);
+  void   rescore(const vector<int>& s, TFscore& t, const vector<int>& windows);
   
   //size_t getSize();
   //void   serialize(void *buf) const;
@@ -140,5 +159,38 @@ public:
   void write(ptree& pt);
 };
 
+/* the lookup tables a pssm is scanned with, built from its current matrix */
+struct PWMTables
+{
+  int pwmlen;
+  int ndist;
+  int mdist;
+  int nchunks;            // the number of chunks of rows
+  vector<int>    offset;  // where in the window each chunk reads
+  vector<double> ftab;    // one row at a time, N included
+  vector<double> ctab;
+  vector<double> fchunk;  // a chunk of rows at a time, for every k-mer
+  vector<double> cchunk;
+};
+
+/* Scores any number of pssms over a sequence in one pass. The sequence is
+packed into 2 bit codes once, and every pssm adds several of its rows with a
+single lookup into a table over k-mers. Add the pssms, then scan each sequence
+with a TFscore for each, already sized to the sequence. The tables are only as
+current as the matrices were when added, so build a new scanner after a pssm
+moves */
+class PWMScanner
+{
+private:
+  vector<PWMTables>     tables;
+  vector<unsigned char> code;     // the packed sequence
+  vector<int>           nprefix;  // the Ns before each position
+  
+public:
+  void add(PWM& pwm);
+  int  size() { return tables.size(); }
+  void scan(const vector<int>& s, vector<TFscore*>& scores, int from, int to);
+};
+
 #endif
 
@@ -12,6 +12,60 @@
 
 # define foreach_ BOOST_FOREACH
 
+SiteNeighbors::SiteNeighbors(site_ptr_vector& targets, double max_dist) :
+  targets(targets),
+  max_dist(max_dist),
+  start(0)
+{}
+
+/* the targets in range of an actor are contiguous, and the first one only moves
+forward as the actors do. Targets that end max_dist before the actor starts are
+out of range of every later actor too, and once a target starts max_dist after
+the actor ends, so do all the rest. A target overlapping a long actor can sit
+between two that are in range, so it is kept and left to the caller */
+void SiteNeighbors::find(BindingSite& actor, int& first, int& last)
+{
+  int ntargets = targets.size();
+  while (start < ntargets && actor.m - targets[start]->n >= max_dist)
+    start++;
+  
+  first = start;
+  last  = start;
+  bool found = false;
+  for (int i=start; i<ntargets; i++)
+  {
+    BindingSite& target = *targets[i];
+    if (siteDistance(actor, target) < max_dist)
+    {
+      if (!found) 
+      {
+        found = true;
+        first = i;
+        start = i;
+      }
+      last = i+1;
+    } 
+    else if (target.m - actor.n >= max_dist)
+      break;
+  }
+}
+
+double siteDistance(BindingSite& actor, BindingSite& target)
+{
+  int dm = abs(actor.m - target.n);
+  int dn = abs(actor.n - target.m);
+  
+  if (dn <= dm)
+    return dn;
+  else
+    return dm;
+}
+
+bool sitesOverlap(BindingSite& actor, BindingSite& target)
+{
+  return (actor.m < target.n && target.m < actor.n);
+}
+
 QuenchingInteractions::QuenchingInteractions() {}
 
 void QuenchingInteractions
@@ -25,15 +79,19 @@ void QuenchingInteractions
   dist = distances->getDistance("Quenching");
   
   int ngenes = genes->size();
+  quenches.resize(ngenes);
+  saved_quenches.resize(ngenes);
+  spare_quenches.resize(ngenes);
   for (int k=0; k<ngenes; k++)
   {
     Gene& gene = genes->getGene(k);
     
-    gene_quenches_ptr gquenches(new gene_quenches);
-    gene_quenches_ptr saved_gquenches(new gene_quenches);
+    gene_quenches_ptr gquenches(new GeneQuenches);
+    gene_quenches_ptr saved_gquenches(new GeneQuenches);
     
     quenches[&gene]       = gquenches;
     saved_quenches[&gene] = saved_gquenches;
+    spare_quenches[&gene] = gene_quenches_ptr();
     
     int ntfs   = tfs->size();
     for (int i = 0; i<ntfs; i++) // loop through actors
@@ -54,71 +112,45 @@ void QuenchingInteractions
 void QuenchingInteractions
 ::set(Gene& gene, TF& actor, TF& target)
 {
-  site_ptr_vector::iterator aiter;
-  site_ptr_vector::iterator titer;
-  
   site_ptr_vector& actorsites  = bindings->getSites(gene, actor);
   site_ptr_vector& targetsites = bindings->getSites(gene, target);
   
-  gene_quenches& gquenches = *(quenches[&gene]);
-  vector<QuenchingInteraction>& q = gquenches[&actor][&target];
-
-  double max_dist     = dist->getMaxDistance();
-  //int    nactors      = actorsites.size();
-  int    ntargets     = targetsites.size();
-  int    start = 0;
+  GeneQuenches& gquenches = *(quenches[&gene]);
+  vector<QuenchingInteraction>& q = gquenches.interactions;
+  
+  QuenchingBlock block;
+  block.actor  = &actor;
+  block.target = &target;
+  block.start  = q.size();
   
-  for (aiter=actorsites.begin(); aiter != actorsites.end(); ++aiter)
+  SiteNeighbors neighbors(targetsites, dist->getMaxDistance());
+  int nactors = actorsites.size();
+  
+  for (int i=0; i<nactors; i++)
   {
-    int c = 0; // value used to see if we 
-    BindingSite& actor     = *(*aiter);
-    //site_ptr     actor_ptr = *aiter;
-    int m1 = actor.m;
-    int n1 = actor.n;
-    
-    // note this only works if sites are ordered! (which they are because we did a linear search on DNA)
-    for (int i=start; (i<ntargets && c!=2); i++)
+    BindingSite& actor_site = *actorsites[i];
+    int first, last;
+    neighbors.find(actor_site, first, last);
+    for (int j=first; j<last; j++)
     {
-      site_ptr     target_ptr = targetsites[i];
-      BindingSite& target     = *target_ptr;
-      
-      int m2 = target.m;
-      int n2 = target.n;
-      double d;
-      
-      int dm = abs(m1 - n2);
-      int dn = abs(n1 - m2);
-      
-      if (dn <= dm)
-        d = dn;
-      else
-        d = dm;
+      BindingSite& target_site = *targetsites[j];
+      if (sitesOverlap(actor_site, target_site)) continue;
       
-      bool  overlapped = (m1 < n2 && m2 < n1);
-      double df        = dist->getDistFunc(d);
-      if ( d < max_dist)
-      {
-        if (c==0) // we found the first site in range
-        {
-          c++; 
-          start = i; // since this is the first site in range, and the next site is farther down, this is the starting point for our next loop
-        }
-        if (!overlapped && df > 0)
-        {
-          QuenchingInteraction quench;
-          quench.actor  = *aiter;
-          quench.target = target_ptr;
-          quench.distcoef = df;
-          
-          q.push_back(quench);
-        }
-      } 
-      else
+      double df = dist->getDistFunc(siteDistance(actor_site, target_site));
+      if (df > 0)
       {
-        if (c==1) c++; // we found the last site in range
+        QuenchingInteraction quench;
+        quench.actor    = &actor_site;
+        quench.target   = &target_site;
+        quench.distcoef = df;
+        
+        q.push_back(quench);
       }
     }
   }
+  block.end = q.size();
+  if (block.end > block.start)
+    gquenches.blocks.push_back(block);
 }
   
 
@@ -158,74 +190,116 @@ void QuenchingInteractions
 void QuenchingInteractions
 ::calc(Gene& gene)
 {
-  initialize(gene);
-    
-  int ntfs   = tfs->size();
-  for (int i = 0; i<ntfs; i++) // loop through actors
-  {
-    TF& tf1 = tfs->getTF(i);
-    if (tf1.neverQuenches()) continue; // skip if never a quencher
-    for (int j=0; j<ntfs; j++) // loop through targets
-    {
-      TF& tf2 = tfs->getTF(j);
-      if (tf2.neverActivates()) continue; // skip if never an activator
-      calc(gene, tf1, tf2);
-    }
-  } 
+  calc(gene, 0, bindings->getNnuc());
+}
+
+void QuenchingInteractions
+::calc(Gene& gene, int first, int last)
+{
+  initialize(gene, first, last);
+  
+  GeneQuenches& gquenches = *(quenches[&gene]);
+  int nblocks = gquenches.blocks.size();
+  for (int i=0; i<nblocks; i++)
+    calc(gquenches, gquenches.blocks[i], first, last);
 }
   
 void QuenchingInteractions
 ::calc(Gene& gene, TF& actor, TF& target)
 {
-  gene_quenches& gquenches = *(quenches[&gene]);
-  vector<QuenchingInteraction>& quench_vector = gquenches[&actor][&target];
-  
-  vector<double> actor_coefs  = actor.getCoefs();
-  vector<double> target_coefs = target.getCoefs();
+  GeneQuenches& gquenches = *(quenches[&gene]);
+  int nblocks = gquenches.blocks.size();
+  for (int i=0; i<nblocks; i++)
+  {
+    QuenchingBlock& block = gquenches.blocks[i];
+    if (block.actor == &actor && block.target == &target)
+      calc(gquenches, block, 0, bindings->getNnuc());
+  }
+}
+
+/* quench target by every actor mode in turn. The actor modes are applied to
+each nucleus in the same order as they would be one vector at a time */
+static void quench_f(const vector<double*>& actor_vecs, const vector<double>& efds, 
+                     double* __restrict__ target_vec, int start, int end)
+{
+  int nmodes = efds.size();
+  if (nmodes == 1)
+  {
+    const double* __restrict__ a = actor_vecs[0];
+    double efd = efds[0];
+    for (int i=start; i<end; i++)
+      target_vec[i] *= 1 - a[i] * efd;
+    return;
+  }
+  for (int i=start; i<end; i++)
+  {
+    double t = target_vec[i];
+    for (int j=0; j<nmodes; j++)
+      t *= 1 - actor_vecs[j][i] * efds[j];
+    target_vec[i] = t;
+  }
+}
+
+void QuenchingInteractions
+::calc(GeneQuenches& gquenches, QuenchingBlock& block, int first, int last)
+{
+  const vector<double>& actor_coefs  = block.actor->getCoefSnapshot();
+  const vector<double>& target_coefs = block.target->getCoefSnapshot();
 
   int n_actor_modes  = actor_coefs.size();
   int n_target_modes = target_coefs.size();
   
-  int nquench = quench_vector.size();
+  // only modes that quench and modes that activate take part
+  vector<int> actor_modes;
+  vector<int> target_modes;
+  for (int j=0; j<n_actor_modes; j++)
+    if (-actor_coefs[j] > 0) actor_modes.push_back(j);
+  for (int k=0; k<n_target_modes; k++)
+    if (target_coefs[k] > 0) target_modes.push_back(k);
   
-  for (int i=0; i<nquench; i++)
+  int nactive = actor_modes.size();
+  int ntarget = target_modes.size();
+  if (nactive == 0 || ntarget == 0 || first >= last) return;
+  
+  /* the actor has no occupancy, and so does not quench, in nuclei it is absent
+  from. Only the runs of nuclei it is present in are visited */
+  vector<int>& runs = bindings->getActive(*block.actor);
+  vector<int>  spans;
+  int nruns = runs.size();
+  for (int r=0; r<nruns; r+=2)
   {
-    QuenchingInteraction& quench      = quench_vector[i];
-    BindingSite& actor_site  = *quench.actor;
-    BindingSite& target_site = *quench.target;
-    double distcoef          = quench.distcoef;
-
-    vector<double>* actor_occupancy;
-    vector<double>* target_occupancy;
+    int start = max(runs[r],   first);
+    int end   = min(runs[r+1], last);
+    if (start >= end) continue;
+    spans.push_back(start);
+    spans.push_back(end);
+  }
+  int nspans = spans.size();
+  if (nspans == 0) return;
+  
+  vector<double*> actor_vecs(nactive);
+  vector<double>  efds(nactive);
+  
+  for (int i=block.start; i<block.end; i++)
+  {
+    QuenchingInteraction& quench = gquenches.interactions[i];
+    BindingSite& actor_site      = *quench.actor;
+    BindingSite& target_site     = *quench.target;
+    double distcoef              = quench.distcoef;
     
-    for (int j=0; j<n_actor_modes; j++)
+    for (int j=0; j<nactive; j++)
     {
-      double efficiency = -actor_coefs[j];
-      if (efficiency <= 0) continue;
-      double efd = efficiency * distcoef;
-      actor_occupancy = &(actor_site.mode_occupancy[j]);
-      for (int k=0; k<n_target_modes; k++)
-      {
-        if (target_coefs[k] <= 0) continue;
-        
-        target_occupancy = &(target_site.effective_occupancy[k]);
-        quench_f(*actor_occupancy, *target_occupancy, efd);
-      }
+      int mode = actor_modes[j];
+      actor_vecs[j] = &(actor_site.mode_occupancy[mode][0]);
+      efds[j]       = -actor_coefs[mode] * distcoef;
+    }
+    
+    for (int k=0; k<ntarget; k++)
+    {
+      double* target_occupancy = &target_site.effective_occupancy[target_modes[k]][0];
+      for (int r=0; r<nspans; r+=2)
+        quench_f(actor_vecs, efds, target_occupancy, spans[r], spans[r+1]);
     }
-  }
-}
-
-
-void QuenchingInteractions
-::quench_f(vector<double>& actor_vec, vector<double>& target_vec, double efd)
-{
-  vector<double>::iterator i;
-  vector<double>::iterator j;
-  //int n = actor_vec.size();
-  for (i = actor_vec.begin(), j = target_vec.begin() ; i != actor_vec.end(); ++i, ++j)
-  {
-    double reduction = 1 - (*i) * efd;
-    (*j) *= reduction;
   }
 }
 
@@ -240,14 +314,34 @@ void QuenchingInteractions
   }
 }
 
+/* Saving shares the current interactions with the save instead of copying them.
+Updating then builds in a different map, so restoring and accepting only move
+pointers. The map a move leaves behind is kept to be rebuilt in next time */
 void QuenchingInteractions
 ::save(Gene& gene)
 {
-  gene_quenches& gquenches       = *(quenches[&gene]);
-  gene_quenches& saved_gquenches = *(saved_quenches[&gene]);
+  gene_quenches_ptr& gquenches       = quenches[&gene];
+  gene_quenches_ptr& saved_gquenches = saved_quenches[&gene];
+  if (saved_gquenches != gquenches)
+    spare_quenches[&gene] = saved_gquenches;
   saved_gquenches = gquenches;
 }
 
+// make sure changing the interactions of gene does not change the save
+void QuenchingInteractions
+::detach(Gene& gene)
+{
+  gene_quenches_ptr& gquenches = quenches[&gene];
+  if (gquenches != saved_quenches[&gene]) return;
+  
+  gene_quenches_ptr& spare = spare_quenches[&gene];
+  if (spare)
+    gquenches = spare;
+  else
+    gquenches = gene_quenches_ptr(new GeneQuenches);
+  spare.reset();
+}
+
 void QuenchingInteractions
 ::clear()
 {
@@ -262,7 +356,8 @@ void QuenchingInteractions
 void QuenchingInteractions
 ::clear(Gene& gene)
 {
-  gene_quenches& gquenches = *(quenches[&gene]);
+  detach(gene);
+  GeneQuenches& gquenches = *(quenches[&gene]);
   gquenches.clear();
 }
 
@@ -280,8 +375,10 @@ void QuenchingInteractions
 void QuenchingInteractions
 ::restore(Gene& gene)
 {
-  gene_quenches& gquenches       = *(quenches[&gene]);
-  gene_quenches& saved_gquenches = *(saved_quenches[&gene]);
+  gene_quenches_ptr& gquenches       = quenches[&gene];
+  gene_quenches_ptr& saved_gquenches = saved_quenches[&gene];
+  if (gquenches != saved_gquenches)
+    spare_quenches[&gene] = gquenches;
   gquenches = saved_gquenches;
 }
 
@@ -302,21 +399,16 @@ void QuenchingInteractions
 {
   int ntfs   = tfs->size();
 
-  gene_quenches& gquenches       = *(quenches[&gene]);
+  detach(gene);
+  quenches[&gene]->clear();
   
   for (int i = 0; i<ntfs; i++) // loop through actors
   {
     TF& tf1 = tfs->getTF(i);
-    if (tf1.neverQuenches())
-    {
-      gquenches[&tf1].clear(); // make sure it is empty if it never quenches
-      
-      continue;                      // skip if not a quencher
-    }
+    if (tf1.neverQuenches()) continue; // skip if not a quencher
     for (int j=0; j<ntfs; j++) // loop through targets
     {
       TF& tf2 = tfs->getTF(j);
-      gquenches[&tf1][&tf2].clear(); // make sure it is empty
       if (tf2.neverActivates()) continue;  // skip if never an activator
       set(gene, tf1, tf2);
     }
@@ -333,7 +425,7 @@ void QuenchingInteractions
   for (int i=0; i<ngenes; i++)
   {
     Gene& gene = genes->getGene(i);
-    gene_quenches& gquenches = *(quenches[&gene]);
+    GeneQuenches& gquenches = *(quenches[&gene]);
     cerr << gene.getName() << endl;
     for (int j=0; j<ntfs; j++)
     {
@@ -341,7 +433,10 @@ void QuenchingInteractions
       for (int k=0; k<ntfs; k++)
       {
         TF& tf2 = tfs->getTF(k);
-        int nq = gquenches[&tf1][&tf2].size();
+        int nq = 0;
+        foreach_(QuenchingBlock& block, gquenches.blocks)
+          if (block.actor == &tf1 && block.target == &tf2)
+            nq += block.end - block.start;
         cerr << tf1.getName() << " -> " << tf2.getName() << " : " << nq << endl;
         total += nq;
       }
@@ -363,22 +458,33 @@ void QuenchingInteractions
 
 void QuenchingInteractions
 ::initialize(Gene& gene)
+{
+  initialize(gene, 0, bindings->getNnuc());
+}
+
+void QuenchingInteractions
+::initialize(Gene& gene, int first, int last)
 {
   int ntfs   = tfs->size();
   for (int j = 0; j<ntfs; j++) 
   {
     TF& tf = tfs->getTF(j);
-    initialize(gene, tf);
+    initialize(gene, tf, first, last);
   }
 }
-      
 
 void QuenchingInteractions
 ::initialize(Gene& gene, TF& tf)
+{
+  initialize(gene, tf, 0, bindings->getNnuc());
+}
+
+void QuenchingInteractions
+::initialize(Gene& gene, TF& tf, int first, int last)
 {
   site_ptr_vector& sites = bindings->getSites(gene, tf);
 
-  vector<double> coefs = tf.getCoefs();
+  const vector<double>& coefs = tf.getCoefSnapshot();
   
   int nmodes = coefs.size();
   int nsites = sites.size();
@@ -386,15 +492,19 @@ void QuenchingInteractions
   for (int i=0; i<nsites; i++)
   {
     BindingSite* site = sites[i].get();
-    int nnuc = site->total_occupancy.size();
     for (int j=0; j<nmodes; j++)
     {
+      vector<double>& eff_occ = site->effective_occupancy[j];
       if (coefs[j] > 0)
-        site->effective_occupancy[j] = site->mode_occupancy[j];
+      {
+        vector<double>& mode_occ = site->mode_occupancy[j];
+        for (int k=first; k<last; k++)
+          eff_occ[k] = mode_occ[k];
+      }
       else
       {
-        for (int k=0; k<nnuc; k++)
-          site->effective_occupancy[j][k] = 0;
+        for (int k=first; k<last; k++)
+          eff_occ[k] = 0;
       }
     }
   }
@@ -417,6 +527,9 @@ void ModifyingInteractions
   dist = distances->getDistance("Quenching");
 
   int ngenes = genes->size();
+  mods.resize(ngenes);
+  saved_mods.resize(ngenes);
+  spare_mods.resize(ngenes);
   for (int k=0; k<ngenes; k++)
   {
     Gene& gene = genes->getGene(k);
@@ -426,6 +539,7 @@ void ModifyingInteractions
     
     mods[&gene]       = gmods;
     saved_mods[&gene] = saved_gmods;
+    spare_mods[&gene] = gene_mods_ptr();
     
     int ntfs   = tfs->size();
     for (int i = 0; i<ntfs; i++) // loop through actors
@@ -453,34 +567,21 @@ void ModifyingInteractions
   gene_mods& gmods = *(mods[&gene]);
   vector<ModifyingInteraction>& v = gmods[&actor][&target];
   
-  double max_dist     = coef->getMaxDistance();
-  int    nactors      = actorsites.size();
-  int    ntargets     = targetsites.size();
+  SiteNeighbors neighbors(targetsites, coef->getMaxDistance());
+  int nactors = actorsites.size();
 
   for (int i=0; i<nactors; i++)
   {
-    site_ptr actor_ptr  = actorsites[i];
-    for (int j=0; j<ntargets; j++)
+    site_ptr actor_ptr = actorsites[i];
+    int first, last;
+    neighbors.find(*actor_ptr, first, last);
+    for (int j=first; j<last; j++)
     {
       site_ptr target_ptr = targetsites[j];
+      if (sitesOverlap(*actor_ptr, *target_ptr)) continue;
       
-      int m1 = actor_ptr->m;
-      int n1 = actor_ptr->n;
-      int m2 = target_ptr->m;  
-      int n2 = target_ptr->n;  
-      double d;
-      
-      int dm = abs(m1 - n2);
-      int dn = abs(n1 - m2);
-      
-      if (dn <= dm)
-        d = dn;
-      else
-        d = dm;
-      
-      bool  overlapped = (m1 < n2 && m2 < n1);
-      double df        = coef->distFunc(d);
-      if ( d < max_dist && !overlapped && df > 0)
+      double df = coef->distFunc(siteDistance(*actor_ptr, *target_ptr));
+      if (df > 0)
       {
         ModifyingInteraction mod;
         mod.actor  = actor_ptr;
@@ -580,7 +681,13 @@ void ModifyingInteractions
 void ModifyingInteractions
 ::calc(Gene& gene)
 {
-  initialize(gene);
+  calc(gene, 0, bindings->getNnuc());
+}
+
+void ModifyingInteractions
+::calc(Gene& gene, int first, int last)
+{
+  initialize(gene, first, last);
 
   int ntfs   = tfs->size();
   for (int i = 0; i<ntfs; i++) // loop through actors
@@ -593,7 +700,7 @@ void ModifyingInteractions
       pair<TF*, coeffect_ptr>& tmp_pair = targets[j];
       TF&          tf2      = *(tmp_pair.first);
       coeffect_ptr cur_coef = tmp_pair.second;
-      calc(gene, tf1, tf2, cur_coef);
+      calc(gene, tf1, tf2, cur_coef, first, last);
     }
   }   
 
@@ -601,6 +708,12 @@ void ModifyingInteractions
 
 void ModifyingInteractions
 ::calc(Gene& gene, TF& actor, TF& target, coeffect_ptr coef)
+{
+  calc(gene, actor, target, coef, 0, bindings->getNnuc());
+}
+
+void ModifyingInteractions
+::calc(Gene& gene, TF& actor, TF& target, coeffect_ptr coef, int first, int last)
 {
   gene_mods& gmods = *(mods[&gene]);
   vector<ModifyingInteraction>& mod_vector = gmods[&actor][&target];
@@ -622,7 +735,7 @@ void ModifyingInteractions
     vector<double>& start_occupancy = target_site.mode_occupancy[0];
     vector<double>& end_occupancy   = target_site.mode_occupancy[coef_idx];
     
-    mod_f(actor_occupancy, start_occupancy, end_occupancy, efficiency, distcoef);
+    mod_f(actor_occupancy, start_occupancy, end_occupancy, efficiency, distcoef, first, last);
   } 
 }
 
@@ -630,11 +743,9 @@ void ModifyingInteractions
 ::mod_f(vector<double>& actor_vec, 
         vector<double>& start_vec,
         vector<double>& end_vec,
-        double ef, double d)
+        double ef, double d, int first, int last)
 {
-  int n = actor_vec.size();
-
-  for (int i=0; i<n; i++)
+  for (int i=first; i<last; i++)
   {
     double actor_occupancy = actor_vec[i];
     double reduction = actor_occupancy * ef * d;
@@ -659,18 +770,29 @@ void ModifyingInteractions
 
 void ModifyingInteractions
 ::initialize(Gene& gene)
+{
+  initialize(gene, 0, bindings->getNnuc());
+}
+
+void ModifyingInteractions
+::initialize(Gene& gene, int first, int last)
 {
   int ntfs   = tfs->size();
   for (int j = 0; j<ntfs; j++) 
   {
     TF& tf = tfs->getTF(j);
-    initialize(gene, tf);
+    initialize(gene, tf, first, last);
   }
 }
-      
 
 void ModifyingInteractions
 ::initialize(Gene& gene, TF& tf)
+{
+  initialize(gene, tf, 0, bindings->getNnuc());
+}
+
+void ModifyingInteractions
+::initialize(Gene& gene, TF& tf, int first, int last)
 {
   int nmodes             = tf.getNumModes();
   site_ptr_vector& sites = bindings->getSites(gene, tf);
@@ -681,12 +803,13 @@ void ModifyingInteractions
   {
     BindingSite* site = sites[i].get();
     vector<double>& total_occupancy = site->total_occupancy;
-    site->mode_occupancy[0] = total_occupancy;
-    int n = total_occupancy.size();
+    vector<double>& mode_occupancy  = site->mode_occupancy[0];
+    for (int k=first; k<last; k++)
+      mode_occupancy[k] = total_occupancy[k];
     for (int j=1; j<nmodes; j++)
     {
       vector<double>& tmp_occ = site->mode_occupancy[j];
-      for (int k=0; k<n; k++)
+      for (int k=first; k<last; k++)
         tmp_occ[k] = 0;
     }
   }
@@ -698,11 +821,26 @@ void ModifyingInteractions
 void ModifyingInteractions
 ::save(Gene& gene)
 {
-
-  gene_mods& gmods       = *(mods[&gene]);
-  gene_mods& saved_gmods = *(saved_mods[&gene]);
+  gene_mods_ptr& gmods       = mods[&gene];
+  gene_mods_ptr& saved_gmods = saved_mods[&gene];
+  if (saved_gmods != gmods)
+    spare_mods[&gene] = saved_gmods;
   saved_gmods = gmods;
+}
 
+// as for quenching, so the save is left alone
+void ModifyingInteractions
+::detach(Gene& gene)
+{
+  gene_mods_ptr& gmods = mods[&gene];
+  if (gmods != saved_mods[&gene]) return;
+  
+  gene_mods_ptr& spare = spare_mods[&gene];
+  if (spare)
+    gmods = spare;
+  else
+    gmods = gene_mods_ptr(new gene_mods);
+  spare.reset();
 }
 
 void ModifyingInteractions
@@ -719,6 +857,7 @@ void ModifyingInteractions
 void ModifyingInteractions
 ::clear(Gene& gene)
 {
+  detach(gene);
   gene_mods& gmods = *(mods[&gene]);
   gmods.clear();
 }
@@ -737,8 +876,10 @@ void ModifyingInteractions
 void ModifyingInteractions
 ::restore(Gene& gene)
 {
-  gene_mods& gmods       = *(mods[&gene]);
-  gene_mods& saved_gmods = *(saved_mods[&gene]);
+  gene_mods_ptr& gmods       = mods[&gene];
+  gene_mods_ptr& saved_gmods = saved_mods[&gene];
+  if (gmods != saved_gmods)
+    spare_mods[&gene] = gmods;
   gmods = saved_gmods;
 }
 
@@ -768,6 +909,7 @@ void ModifyingInteractions
 void ModifyingInteractions
 ::update(Gene& gene)
 {
+  detach(gene);
   gene_mods& gmods = *(mods[&gene]);
   int ntfs   = tfs->size();
   for (int i = 0; i<ntfs; i++) // loop through actors
@@ -23,25 +23,64 @@ using namespace std;
 to decide what repression coefficients and what occupancies to use. The modified or
 the regular */
 
+/* finds the targets in range of each actor in turn by sweeping along the
+targets. Both must be ordered by position (which they are because we did a
+linear search on DNA) and the actors must be passed in order */
+class SiteNeighbors
+{
+private:
+  site_ptr_vector& targets;
+  double           max_dist;
+  int              start;
+  
+public:
+  SiteNeighbors(site_ptr_vector& targets, double max_dist);
+  
+  // targets first to last-1 are in range of actor
+  void find(BindingSite& actor, int& first, int& last);
+};
+
+double siteDistance(BindingSite& actor, BindingSite& target);
+bool   sitesOverlap(BindingSite& actor, BindingSite& target);
+
+/* interactions hold raw pointers to the sites. They are rebuilt whenever the
+sites of a gene change, and the saved interactions only point to saved sites,
+which bindings keeps alive until the next save */
 struct QuenchingInteraction
 {
-  site_ptr actor;
-  site_ptr target;
-  double   distcoef;
+  BindingSite* actor;
+  BindingSite* target;
+  double       distcoef;
+};
+
+// the range of interactions between one actor and one target
+struct QuenchingBlock
+{
+  TF* actor;
+  TF* target;
+  int start;
+  int end;
+};
+
+/* all interactions of a gene in one flat vector, in actor/target order, so
+calculating quenching walks them without any map lookups */
+struct GeneQuenches
+{
+  vector<QuenchingBlock>       blocks;
+  vector<QuenchingInteraction> interactions;
+  
+  void clear() { blocks.clear(); interactions.clear(); }
 };
 
-typedef map<TF*, map<TF*, vector<QuenchingInteraction> > > gene_quenches;
-typedef boost::shared_ptr<gene_quenches>                   gene_quenches_ptr;
+typedef boost::shared_ptr<GeneQuenches> gene_quenches_ptr;
 
 class QuenchingInteractions
 {
 private:
-  // quenches[gene][actor][target][index]
-  /* if we parallelize over genes the map is not safe with openMP. I have to have
-  a map of pointers to maps to prevent the latter from moving around with multiple
-  threads */
-  map<Gene*, gene_quenches_ptr > quenches;
-  map<Gene*, gene_quenches_ptr > saved_quenches;
+  // quenches[gene] holds all interactions on that gene
+  IndexMap<Gene, gene_quenches_ptr > quenches;
+  IndexMap<Gene, gene_quenches_ptr > saved_quenches;
+  IndexMap<Gene, gene_quenches_ptr > spare_quenches; // a discarded one to rebuild in
 
   genes_ptr     genes;
   tfs_ptr       tfs;
@@ -51,7 +90,8 @@ private:
   distance_ptr dist;
   
   //bool hasQuenchingInteractions(Gene&, TF& actor, TF& target);
-  void quench_f(vector<double>&,vector<double>&,double);
+  void calc(GeneQuenches&, QuenchingBlock&, int first, int last);
+  void detach(Gene&);
   
 public:
   QuenchingInteractions();
@@ -63,6 +103,7 @@ public:
   void calc();
   void calc(Gene&);
   void calc(Gene&, TF& actor, TF& target);
+  void calc(Gene&, int first, int last); // only nuclei first to last-1
   //void calc(int j);
   //void calc(Gene&, TF& actor, TF& target, int j);
   
@@ -72,6 +113,8 @@ public:
   void initialize(); // sets mode_occupancy to default;
   void initialize(Gene&); // sets mode_occupancy to default;
   void initialize(Gene&, TF&);
+  void initialize(Gene&, int first, int last);
+  void initialize(Gene&, TF&, int first, int last);
   
   void save();
   void clear();
@@ -96,14 +139,15 @@ struct ModifyingInteraction
   coeffect_ptr coef;
 };
 
-typedef map<TF*, map<TF*, vector<ModifyingInteraction> > > gene_mods;
+typedef IndexMap<TF, IndexMap<TF, vector<ModifyingInteraction> > > gene_mods;
 typedef boost::shared_ptr<gene_mods>                       gene_mods_ptr;
 
 class ModifyingInteractions
 {
 private:
-  map<Gene*, gene_mods_ptr > mods;
-  map<Gene*, gene_mods_ptr > saved_mods;
+  IndexMap<Gene, gene_mods_ptr > mods;
+  IndexMap<Gene, gene_mods_ptr > saved_mods;
+  IndexMap<Gene, gene_mods_ptr > spare_mods;
   
   genes_ptr     genes;
   tfs_ptr       tfs;
@@ -112,7 +156,8 @@ private:
   
   distance_ptr dist;
   
-  void mod_f(vector<double>&,vector<double>&,vector<double>&,double,double);
+  void mod_f(vector<double>&,vector<double>&,vector<double>&,double,double,int,int);
+  void detach(Gene&);
 public:
   ModifyingInteractions();
   
@@ -123,6 +168,8 @@ public:
   void calc();
   void calc(Gene&);
   void calc(Gene&, TF& actor, TF& target, coeffect_ptr);
+  void calc(Gene&, int first, int last); // only nuclei first to last-1
+  void calc(Gene&, TF& actor, TF& target, coeffect_ptr, int first, int last);
 
   map<BindingSite*, map<TF*, vector<double> > > getEffq(Gene& gene);
   
@@ -132,6 +179,8 @@ public:
   void initialize(); // sets mode_occupancy to default;
   void initialize(Gene&); // sets mode_occupancy to default;
   void initialize(Gene&, TF&);
+  void initialize(Gene&, int first, int last);
+  void initialize(Gene&, TF&, int first, int last);
   
   void save();
   void clear();
@@ -7,11 +7,15 @@
 *********************************************************************************/
 
 #include "subgroup.h"
+#include "vmath.h"
 #include <boost/foreach.hpp>
 #include <algorithm>
+#include <functional>
 #include <limits>
 #include <cmath>
 #include <climits>
+#include <cfloat>
+#include <cstring>
 
 #define foreach_ BOOST_FOREACH
 
@@ -44,6 +48,13 @@ inline float fast_log2 (float val)
 //   return (val + log_2);
 //}
       
+// 2^d for d <= 0, flushing to 0 when it is not representable
+inline double scale2(int64_t d)
+{
+  if (d < -1074) return 0.0;
+  return ldexp(1.0, (int) d);
+}
+
 /********************************   Subgroup    *********************************/
 
 
@@ -61,11 +72,21 @@ bool compareBindingSiteLeft(BindingSite* a, BindingSite* b)
 
 /*    Constructors    */
 
-Subgroup::Subgroup() {}
+Subgroup::Subgroup() : engine(DYNAMIC), numerics(PLAIN), large(false), version(0), stride(0),
+                       active_version(0), ncols(0), width(0) {}
 
-Subgroup::Subgroup(BindingSite* site, bindings_ptr b) 
+Subgroup::Subgroup(BindingSite* site, bindings_ptr b, int e, int num) 
 {
   bindings  = b;
+  engine    = e;
+  numerics  = num;
+  large     = false;
+  version   = 0;
+  stride    = 0;
+  
+  active_version = 0;
+  ncols          = 0;
+  width          = 0;
   addSite(site);
 }
 
@@ -113,6 +134,15 @@ int Subgroup::getRightBound() const { return right_bound; }
 
 int Subgroup::getLeftBound() const { return left_bound; }
 
+unsigned Subgroup::getVersion() const { return version; }
+
+bool Subgroup::hasTF(TF* tf) const 
+{ 
+  return std::binary_search(factors.begin(), factors.end(), tf); 
+}
+
+void Subgroup::setVersion(unsigned v) { version = v; }
+
 
 /*    Methods   */
 
@@ -169,6 +199,14 @@ bool Subgroup::overlaps(BindingSite* site1, BindingSite* site2)
   return ( site1->m < site2->n && site2->m < site1->n);
 }
 
+// orders indices into a site vector by the left end of the sites
+struct SiteIndexLeft
+{
+  vector<BindingSite*>& sites;
+  SiteIndexLeft(vector<BindingSite*>& s) : sites(s) {}
+  bool operator()(int a, int b) { return compareBindingSiteLeft(sites[a], sites[b]); }
+};
+
 void Subgroup::sort()
 {
   int nsites = sites_f.size();
@@ -176,108 +214,218 @@ void Subgroup::sort()
   std::sort(sites_f.begin(), sites_f.end(), compareBindingSiteRight);
   sites_r.resize(nsites);
   f2r.resize(nsites);
+  
+  /* sort forward indices instead of the sites themselves, so the forward to
+  reverse map falls out of the sort without searching for each site */
+  vector<int> order(nsites);
   for (int i=0; i<nsites; i++) 
-    sites_r[i] = sites_f[nsites - i - 1];
-  std::sort(sites_r.begin(), sites_r.end(), compareBindingSiteLeft);
-
-  for (int i=0; i<nsites; i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), SiteIndexLeft(sites_f));
+  
+  for (int j=0; j<nsites; j++)
   {
-    for (int j=0; j<nsites; j++)
-    {
-      if (sites_f[i] == sites_r[j])
-      {
-        f2r[i] = j;
-        continue;
-      }
-    }
+    sites_r[j]      = sites_f[order[j]];
+    f2r[order[j]]   = j;
   }
+  
+  factors.clear();
+  for (int i=0; i<nsites; i++)
+    factors.push_back(sites_f[i]->tf);
+  std::sort(factors.begin(), factors.end());
+  factors.erase(std::unique(factors.begin(), factors.end()), factors.end());
 }
 
 // for each site, find the last site that does not compete
+/* the largest gap over which a site of tf can cooperate. Distance functions
+are zero past their maximum distance, so nothing further away is checked.
+Capped so the window arithmetic on positions cannot overflow */
+static int coopWindow(TF* tf)
+{
+  if (!tf->ncoops()) return -1;
+  double max_dist = tf->getMaxCoopDistance();
+  return (int) min(floor(max_dist), (double) (INT_MAX/4));
+}
+
 void Subgroup::pre_process()
 {
   int nsites = sites_f.size();
   int nnuc = bindings->getNnuc();
   
-  ZF.resize(nsites+1);
-  ZR.resize(nsites+1);
-    
-#ifdef VERYLARGENUMS
-  ZF[0].log_Z.resize(nnuc);
-  ZF[0].log_Zc.resize(nnuc);
-  ZF[0].log_Znc.resize(nnuc);
+  // start from clean partitions, the interactions are pushed back below
+  ZF.assign(nsites+1, Partition());
+  ZR.assign(nsites+1, Partition());
   
-  ZR[0].log_Z.resize(nnuc);
-  ZR[0].log_Zc.resize(nnuc);
-  ZR[0].log_Znc.resize(nnuc);
-  for (int i=0; i<nnuc; i++)
+  // the ends the sites are sorted by, for the binary searches below
+  vector<int> right_f(nsites);
+  vector<int> left_r(nsites);
+  for (int i=0; i<nsites; i++)
   {
-    ZF[0].log_Z[i] = 0;
-    ZR[0].log_Z[i] = 0;
+    right_f[i] = sites_f[i]->n;
+    left_r[i]  = sites_r[i]->m;
   }
-#else  
-  ZF[0].Z.resize(nnuc);
-  ZF[0].Zc.resize(nnuc);
-  ZF[0].Znc.resize(nnuc);
   
-  ZR[0].Z.resize(nnuc);
-  ZR[0].Zc.resize(nnuc);
-  ZR[0].Znc.resize(nnuc);
-  for (int i=0; i<nnuc; i++)
+  /* the vectorized engine only needs the interactions from ZF and ZR, the
+  partition functions themselves are stored in the tables */
+  if (engine == DYNAMIC)
   {
-    ZF[0].Z[i] = 1.0;
-    ZR[0].Z[i] = 1.0;
-  }
+#ifdef VERYLARGENUMS
+    ZF[0].log_Z.resize(nnuc);
+    ZF[0].log_Zc.resize(nnuc);
+    ZF[0].log_Znc.resize(nnuc);
+    
+    ZR[0].log_Z.resize(nnuc);
+    ZR[0].log_Zc.resize(nnuc);
+    ZR[0].log_Znc.resize(nnuc);
+    for (int i=0; i<nnuc; i++)
+    {
+      ZF[0].log_Z[i] = 0;
+      ZR[0].log_Z[i] = 0;
+    }
+#else  
+    ZF[0].Z.resize(nnuc);
+    ZF[0].Zc.resize(nnuc);
+    ZF[0].Znc.resize(nnuc);
+    
+    ZR[0].Z.resize(nnuc);
+    ZR[0].Zc.resize(nnuc);
+    ZR[0].Znc.resize(nnuc);
+    for (int i=0; i<nnuc; i++)
+    {
+      ZF[0].Z[i] = 1.0;
+      ZR[0].Z[i] = 1.0;
+    }
 #endif
+  }
   
   for (int i=0; i<nsites; i++) // loop over all sites
   {
     int pindex = i + 1;
     
+    if (engine == DYNAMIC)
+    {
 #ifdef VERYLARGENUMS
-    ZF[pindex].log_Z.resize(nnuc);
-    ZF[pindex].log_Zc.resize(nnuc, 0);
-    ZF[pindex].log_Znc.resize(nnuc, 0);
-    
-    ZR[pindex].log_Z.resize(nnuc);
-    ZR[pindex].log_Zc.resize(nnuc, 0);
-    ZR[pindex].log_Znc.resize(nnuc, 0);
+      ZF[pindex].log_Z.resize(nnuc);
+      ZF[pindex].log_Zc.resize(nnuc, 0);
+      ZF[pindex].log_Znc.resize(nnuc, 0);
+      
+      ZR[pindex].log_Z.resize(nnuc);
+      ZR[pindex].log_Zc.resize(nnuc, 0);
+      ZR[pindex].log_Znc.resize(nnuc, 0);
 #else
-    ZF[pindex].Z.resize(nnuc);
-    ZF[pindex].Zc.resize(nnuc, 0);
-    ZF[pindex].Znc.resize(nnuc, 0);
-    
-    ZR[pindex].Z.resize(nnuc);
-    ZR[pindex].Zc.resize(nnuc, 0);
-    ZR[pindex].Znc.resize(nnuc, 0);
+      ZF[pindex].Z.resize(nnuc);
+      ZF[pindex].Zc.resize(nnuc, 0);
+      ZF[pindex].Znc.resize(nnuc, 0);
+      
+      ZR[pindex].Z.resize(nnuc);
+      ZR[pindex].Zc.resize(nnuc, 0);
+      ZR[pindex].Znc.resize(nnuc, 0);
 #endif
+    }
     
     BindingSite* s1f = sites_f[i];
     BindingSite* s1r = sites_r[i];
     
-    TF* tf1f = s1f->tf;
-    TF* tf1r = s1r->tf;
+    /* sites_f is sorted by right end, so the previous sites that do not 
+    overlap s1f are a prefix, and the ones close enough to cooperate are the
+    tail of that prefix. The same holds for sites_r sorted by left end. */
+    int nocomp_f = upper_bound(right_f.begin(), right_f.begin() + i, s1f->m) - right_f.begin();
+    int nocomp_r = upper_bound(left_r.begin(), left_r.begin() + i, s1r->n, greater<int>()) - left_r.begin();
+    
+    ZF[pindex].last = nocomp_f;
+    ZR[pindex].last = nocomp_r;
+    
+    int reach_f = coopWindow(s1f->tf);
+    int reach_r = coopWindow(s1r->tf);
+    
+    int first_f = lower_bound(right_f.begin(), right_f.begin() + nocomp_f, s1f->m - reach_f) - right_f.begin();
+    int first_r = lower_bound(left_r.begin(), left_r.begin() + nocomp_r, s1r->n + reach_r, greater<int>()) - left_r.begin();
     
-    char o1f = s1f->orientation;
-    char o1r = s1r->orientation;
+    for (int j = first_f; j<nocomp_f; j++)
+      pre_process_pair(ZF, i, s1f, s1f->tf, s1f->orientation, j, sites_f[j], sites_f[j]->tf, sites_f[j]->orientation); 
     
-    for (int j = 0; j<i; j++) // loop over previous sites
+    for (int j = first_r; j<nocomp_r; j++)
+      pre_process_pair(ZR, i, s1r, s1r->tf, s1r->orientation, j, sites_r[j], sites_r[j]->tf, sites_r[j]->orientation); 
+  }
+  
+  if (engine == VECTORIZED)
+  {
+    stride = ((nnuc + SIMD_WIDTH - 1)/SIMD_WIDTH)*SIMD_WIDTH;
+    kv_matrix.assign(nsites*stride, 0.0);
+    active_version = 0; // the tfs may have changed
+    
+    // the forward table reads kv rows in order, the reverse table through f2r
+    vector<int> kv_rows_f(nsites);
+    vector<int> kv_rows_r(nsites);
+    for (int i=0; i<nsites; i++)
     {
-      BindingSite* s2f = sites_f[j];
-      BindingSite* s2r = sites_r[j];
-      
-      TF* tf2f = s2f->tf;
-      TF* tf2r = s2r->tf;
-      
-      char o2f = s2f->orientation;
-      char o2r = s2r->orientation;
-      
-      pre_process_pair(ZF, i, s1f, tf1f, o1f, j, s2f, tf2f, o2f); 
-      pre_process_pair(ZR, i, s1r, tf1r, o1r, j, s2r, tf2r, o2r); 
+      kv_rows_f[i]      = i;
+      kv_rows_r[f2r[i]] = i;
+    }
+    compile_table(ZF, kv_rows_f, table_f);
+    compile_table(ZR, kv_rows_r, table_r);
+    
+    // only one set of rows is needed, and it is the wide one only if asked for
+    if (numerics == WIDE)
+    {
+      init_rows<long double>(wide_f, 1.0);
+      init_rows<long double>(wide_r, 1.0);
+    }
+    else
+    {
+      // the null state, log(1) = 0 in log space
+      double null_Z = (numerics == LOGSPACE) ? 0.0 : 1.0;
+      init_rows<double>(rows_f, null_Z);
+      init_rows<double>(rows_r, null_Z);
+    }
+  }
+}
+
+// flatten the interactions found in pre_process into a table
+void Subgroup::compile_table(vector<Partition>& p, vector<int>& kv_rows, PartitionTable& t)
+{
+  int nsites = sites_f.size();
+  
+  t.last.resize(nsites+1);
+  t.kv_row     = kv_rows;
+  t.coop_start.resize(nsites+1);
+  t.coop_row.clear();
+  t.coop_past.clear();
+  t.dist_coef.clear();
+  t.coop.clear();
+  
+  t.last[0]       = 0;
+  t.coop_start[0] = 0;
+  for (int i=1; i<=nsites; i++)
+  {
+    Partition& part = p[i];
+    t.last[i] = part.last;
+    int ncoops = part.coop_site.size();
+    for (int j=0; j<ncoops; j++)
+    {
+      t.coop_row.push_back(kv_rows[part.coop_site[j]]);
+      t.coop_past.push_back(part.coop_past[j]);
+      t.dist_coef.push_back(part.dist_coef[j]);
+      t.coop.push_back(part.coop[j]);
     }
+    t.coop_start[i] = t.coop_row.size();
   }
 }
 
+// allocate the partition function matrices, with row 0 the null state
+template<typename T> 
+void Subgroup::init_rows(PartitionRows<T>& rows, T null_Z)
+{
+  int nsites = sites_f.size();
+  
+  rows.Z.assign((nsites+1)*stride, 0);
+  rows.Zc.assign((nsites+1)*stride, 0);
+  rows.Znc.assign((nsites+1)*stride, 0);
+  rows.Zexp.assign(nsites+1, 0);
+  
+  for (int i=0; i<stride; i++)
+    rows.Z[i] = null_Z;
+}
+
 void Subgroup::pre_process_pair(vector<Partition>& p, int i, BindingSite* s1, TF* tf1, char o1, int j, BindingSite* s2, TF* tf2, char o2)
 {
   int pindex = i + 1;
@@ -432,8 +580,469 @@ iterate_partition(vector<Partition>& p, vector<BindingSite*>& sites, int site_in
 #endif
 }
 
-     
+
+/* the nuclei any tf of the subgroup is present in. This only changes with the
+nuclei, or when the sites are tiled, so it is kept until bindings says so */
+void Subgroup::set_active()
+{
+  unsigned v = bindings->getActivityVersion();
+  if (v == active_version) return;
+  active_version = v;
+  
+  int nnuc = bindings->getNnuc();
+  vector<char> present(nnuc, 0);
+  int nfactors = factors.size();
+  for (int i=0; i<nfactors; i++)
+  {
+    vector<int>& runs = bindings->getActive(*factors[i]);
+    int nruns = runs.size();
+    for (int r=0; r<nruns; r+=2)
+      std::fill(present.begin() + runs[r], present.begin() + runs[r+1], 1);
+  }
+  
+  active.clear();
+  ncols = 0;
+  for (int j=0; j<nnuc; j++)
+  {
+    if (!present[j]) continue;
+    int start = j;
+    while (j<nnuc && present[j]) j++;
+    active.push_back(start);
+    active.push_back(j);
+    ncols += j - start;
+  }
+  width = ((ncols + SIMD_WIDTH - 1)/SIMD_WIDTH)*SIMD_WIDTH;
+  
+  if (ncols < nnuc)
+    occ.resize(ncols);
+  else
+    occ.clear();
+}
+
+/* copy kv of every site into one matrix, so the recursion reads contiguous
+rows instead of chasing a pointer per site. kv changes with every K or lambda
+move, so this has to happen on each calculation. Only the nuclei the rows hold
+are copied, next to each other */
+void Subgroup::gather_kv()
+{
+  int nsites = sites_f.size();
+  int nnuc   = bindings->getNnuc();
+  int nruns  = active.size();
+  
+  for (int i=0; i<nsites; i++)
+  {
+    double*         row = &kv_matrix[i*stride];
+    vector<double>& kv  = sites_f[i]->kv;
+    if (ncols == nnuc)
+    {
+      for (int j=0; j<nnuc; j++)
+        row[j] = kv[j];
+      continue;
+    }
+    int col = 0;
+    for (int r=0; r<nruns; r+=2)
+    {
+      for (int j=active[r]; j<active[r+1]; j++)
+        row[col++] = kv[j];
+    }
+    // the padding must not hold an old kv, scaled rows look at every column
+    for (int j=ncols; j<width; j++)
+      row[j] = 0;
+  }
+}
+
+// where the occupancy of the nuclei the rows hold is written
+double* Subgroup::occupancy_target(BindingSite* site)
+{
+  if (occ.empty())
+    return &site->total_occupancy[0];
+  return &occ[0];
+}
+
+/* spread the occupancy back out to every nucleus, the ones left out of the
+rows have none */
+void Subgroup::store_occupancy(BindingSite* site)
+{
+  vector<double>& total = site->total_occupancy;
+  if (!occ.empty())
+  {
+    std::fill(total.begin(), total.end(), 0.0);
+    int nruns = active.size();
+    int col   = 0;
+    for (int r=0; r<nruns; r+=2)
+    {
+      for (int j=active[r]; j<active[r+1]; j++)
+        total[j] = occ[col++];
+    }
+  }
+  site->mode_occupancy[0] = total;
+}
+
+template<typename T>
+void Subgroup::iterate_table(PartitionTable& t, PartitionRows<T>& z, int site_index)
+{
+  int pindex = site_index + 1;
+  
+  const double* __restrict__ kv     = &kv_matrix[t.kv_row[site_index]*stride];
+  const T*      __restrict__ init_Z = &z.Z[site_index*stride];
+  const T*      __restrict__ last_Z = &z.Z[t.last[pindex]*stride];
+  
+  T* __restrict__ cur_Z   = &z.Z[pindex*stride];
+  T* __restrict__ cur_Znc = &z.Znc[pindex*stride];
+  T* __restrict__ cur_Zc  = &z.Zc[pindex*stride];
+  
+  for (int i=0; i<width; i++)
+  {
+    T new_Z = last_Z[i]*kv[i];
+    cur_Z[i]   = init_Z[i] + new_Z;
+    cur_Znc[i] = new_Z;
+    cur_Zc[i]  = 0;
+  }
+  
+  int coop_end = t.coop_start[pindex];
+  for (int j=t.coop_start[site_index]; j<coop_end; j++)
+  {
+    T kcoop = t.coop[j]->getK();
+    T dfunk = t.dist_coef[j];
+    kcoop *= dfunk;
+    
+    const double* __restrict__ coopkv = &kv_matrix[t.coop_row[j]*stride];
+    const T*      __restrict__ past_Z = &z.Z[t.coop_past[j]*stride];
+    
+    for (int k=0; k<width; k++)
+    {
+      T weight = past_Z[k]*coopkv[k]*kv[k]*kcoop;
+      cur_Z[k]  += weight;
+      cur_Zc[k] += weight;
+    }
+  }
+}
+
+/* Z only grows with pindex, so every row we read is at most the previous row.
+We start the new row on the exponent of the previous one, bring older rows
+onto it with a single scalar factor, and renormalize by a power of two once
+the largest mantissa passes 2^256. Z is at least 1 in every nucleus, so a
+mantissa near the bottom of the double range means that nucleus is losing its
+digits to the others. Returns false if that happened or the row overflowed */
+bool Subgroup::iterate_table_scaled(PartitionTable& t, PartitionRows<double>& z, int site_index)
+{
+  int pindex = site_index + 1;
+  int last   = t.last[pindex];
+  
+  int64_t exponent = z.Zexp[site_index];
+  double  s_last   = scale2(z.Zexp[last] - exponent);
+  
+  const double* __restrict__ kv     = &kv_matrix[t.kv_row[site_index]*stride];
+  const double* __restrict__ init_Z = &z.Z[site_index*stride];
+  const double* __restrict__ last_Z = &z.Z[last*stride];
+  
+  double* __restrict__ cur_Z   = &z.Z[pindex*stride];
+  double* __restrict__ cur_Znc = &z.Znc[pindex*stride];
+  double* __restrict__ cur_Zc  = &z.Zc[pindex*stride];
+  
+  for (int i=0; i<width; i++)
+  {
+    double new_Z = (last_Z[i]*s_last)*kv[i];
+    cur_Z[i]   = init_Z[i] + new_Z;
+    cur_Znc[i] = new_Z;
+    cur_Zc[i]  = 0;
+  }
+  
+  int coop_end = t.coop_start[pindex];
+  for (int j=t.coop_start[site_index]; j<coop_end; j++)
+  {
+    double kcoop  = t.coop[j]->getK();
+    double dfunk  = t.dist_coef[j];
+    double s_past = scale2(z.Zexp[t.coop_past[j]] - exponent);
+    kcoop *= dfunk;
+    
+    const double* __restrict__ coopkv = &kv_matrix[t.coop_row[j]*stride];
+    const double* __restrict__ past_Z = &z.Z[t.coop_past[j]*stride];
+    
+    for (int k=0; k<width; k++)
+    {
+      double weight = (past_Z[k]*s_past)*coopkv[k]*kv[k]*kcoop;
+      cur_Z[k]  += weight;
+      cur_Zc[k] += weight;
+    }
+  }
+  
+  double row_max = 0;
+  double row_min = DBL_MAX;
+  for (int i=0; i<ncols; i++)
+  {
+    row_max = std::max(row_max, cur_Z[i]);
+    row_min = std::min(row_min, cur_Z[i]);
+  }
+  if (!(row_max <= DBL_MAX))
+    return false;
+  
+  if (row_max > 0x1p256)
+  {
+    int    shift = ilogb(row_max);
+    double s     = ldexp(1.0, -shift);
+    for (int i=0; i<width; i++)
+    {
+      cur_Z[i]   *= s;
+      cur_Znc[i] *= s;
+      cur_Zc[i]  *= s;
+    }
+    exponent += shift;
+    row_min  *= s;
+  }
+  z.Zexp[pindex] = exponent;
+  return row_min >= 0x1p62*DBL_MIN;
+}
+
+/* every row is taken relative to the previous one, which is never smaller, so
+all the exponentials have arguments <= 0 and cannot overflow */
+void Subgroup::iterate_table_log(PartitionTable& t, PartitionRows<double>& z, int site_index)
+{
+  int pindex = site_index + 1;
+  
+  const double* __restrict__ kv        = &kv_matrix[t.kv_row[site_index]*stride];
+  const double* __restrict__ init_logZ = &z.Z[site_index*stride];
+  const double* __restrict__ last_logZ = &z.Z[t.last[pindex]*stride];
+  
+  double* __restrict__ cur_logZ = &z.Z[pindex*stride];
+  double* __restrict__ cur_Znc  = &z.Znc[pindex*stride];
+  double* __restrict__ cur_Zc   = &z.Zc[pindex*stride];
+  
+  // accumulate Znc/Z and Zc/Z of the previous partition
+  for (int i=0; i<width; i++)
+  {
+    cur_Znc[i] = vexp(last_logZ[i] - init_logZ[i])*kv[i];
+    cur_Zc[i]  = 0;
+  }
+  
+  int coop_end = t.coop_start[pindex];
+  for (int j=t.coop_start[site_index]; j<coop_end; j++)
+  {
+    double kcoop = t.coop[j]->getK();
+    double dfunk = t.dist_coef[j];
+    kcoop *= dfunk;
+    
+    const double* __restrict__ coopkv    = &kv_matrix[t.coop_row[j]*stride];
+    const double* __restrict__ past_logZ = &z.Z[t.coop_past[j]*stride];
+    
+    for (int k=0; k<width; k++)
+      cur_Zc[k] += vexp(past_logZ[k] - init_logZ[k])*coopkv[k]*kv[k]*kcoop;
+  }
+  
+  for (int i=0; i<width; i++)
+  {
+    double ratio = 1 + cur_Znc[i] + cur_Zc[i];
+    cur_logZ[i]  = init_logZ[i] + vlog(ratio);
+    cur_Znc[i]  /= ratio;
+    cur_Zc[i]   /= ratio;
+  }
+}
+
+/* the occupancy of one site from the forward and reverse partitions. These are
+kept as functions so that the restrict qualifiers hold and the loops vectorize.
+When kv is 0 so is the numerator, and the max gives an occupancy of 0 */
+template<typename T>
+static void site_occupancy(int n,
+                           const T* __restrict__ zfnc, const T* __restrict__ zrnc,
+                           const T* __restrict__ zfc,  const T* __restrict__ zrc,
+                           const T* __restrict__ Z,    const double* __restrict__ kv,
+                           double s1, double s2, double* __restrict__ f)
+{
+  for (int j=0; j<n; j++)
+  {
+    T num = (zfnc[j] + zfc[j])*(zrnc[j] + zrc[j]) - zrc[j]*zfc[j];
+    f[j] = ((num*s1)/std::max(Z[j]*kv[j], (T) DBL_MIN))*s2;
+  }
+}
+
+/* in log space the partitions hold log(Z), and Znc and Zc are fractions of Z.
+The numerator is expanded so there is no cancellation */
+static void site_occupancy_log(int n,
+                               const double* __restrict__ logzf, const double* __restrict__ logzr,
+                               const double* __restrict__ qfnc,  const double* __restrict__ qrnc,
+                               const double* __restrict__ qfc,   const double* __restrict__ qrc,
+                               const double* __restrict__ logZ,  const double* __restrict__ kv,
+                               double* __restrict__ f)
+{
+  for (int j=0; j<n; j++)
+  {
+    double q     = qfnc[j]*qrnc[j] + qfnc[j]*qrc[j] + qfc[j]*qrnc[j];
+    double log_f = logzf[j] + logzr[j] - logZ[j] + vlog(std::max(q, DBL_MIN)) - vlog(std::max(kv[j], DBL_MIN));
+    f[j] = (q > 0) ? vexp(log_f) : 0.0;
+  }
+}
+
+/* returns false, without setting any occupancy, if Z reached limit, which for
+auto leaves room for the products of partial partition functions */
+template<typename T>
+bool Subgroup::occupancy_plain(PartitionRows<T>& zf, PartitionRows<T>& zr, T limit)
+{
+  int nsites = sites_f.size();
+  
+  for (int i=0; i<nsites; i++)
+  {
+    iterate_table(table_f, zf, i);
+    iterate_table(table_r, zr, i);
+  }
+  
+  // Z is the largest row, so if anything overflowed it did
+  const T* Z = &zf.Z[nsites*stride];
+  for (int j=0; j<ncols; j++)
+  {
+    if (!(Z[j] < limit))
+      return false;
+  }
+  
+  for (int i=0; i<nsites; i++)
+  {
+    int r_idx = f2r[i];
+    
+    int f_row = (i+1)*stride;
+    int r_row = (r_idx+1)*stride;
+    
+    BindingSite* site = sites_f[i];
+    
+    site_occupancy<T>(ncols, &zf.Znc[f_row], &zr.Znc[r_row],
+                            &zf.Zc[f_row],  &zr.Zc[r_row],
+                            Z, &kv_matrix[i*stride], 1.0, 1.0, occupancy_target(site));
+    store_occupancy(site);
+  }
+  return true;
+}
+
+// returns false, without setting any occupancy, if some row lost its range
+bool Subgroup::occupancy_scaled()
+{
+  int nsites = sites_f.size();
+  
+  bool in_range = true;
+  for (int i=0; i<nsites && in_range; i++)
+  {
+    in_range = iterate_table_scaled(table_f, rows_f, i) && in_range;
+    in_range = iterate_table_scaled(table_r, rows_r, i) && in_range;
+  }
+  if (!in_range)
+    return false;
+  
+  const double* Z    = &rows_f.Z[nsites*stride];
+  int64_t       Zexp = rows_f.Zexp[nsites];
+  
+  for (int i=0; i<nsites; i++)
+  {
+    int r_idx = f2r[i];
+    
+    int f_row = (i+1)*stride;
+    int r_row = (r_idx+1)*stride;
+    
+    int64_t d  = rows_f.Zexp[i+1] + rows_r.Zexp[r_idx+1] - Zexp;
+    int64_t d1 = d/2;
+    double  s1 = ldexp(1.0, (int) max<int64_t>(min<int64_t>(d1,   1023), -1074));
+    double  s2 = ldexp(1.0, (int) max<int64_t>(min<int64_t>(d-d1, 1023), -1074));
+    
+    BindingSite* site = sites_f[i];
+    
+    site_occupancy<double>(ncols, &rows_f.Znc[f_row], &rows_r.Znc[r_row],
+                                 &rows_f.Zc[f_row],  &rows_r.Zc[r_row],
+                                 Z, &kv_matrix[i*stride], s1, s2, occupancy_target(site));
+    store_occupancy(site);
+  }
+  return true;
+}
+
+void Subgroup::occupancy_log()
+{
+  int nsites = sites_f.size();
+  
+  for (int i=0; i<nsites; i++)
+  {
+    iterate_table_log(table_f, rows_f, i);
+    iterate_table_log(table_r, rows_r, i);
+  }
+  
+  const double* logZ = &rows_f.Z[nsites*stride];
+  
+  for (int i=0; i<nsites; i++)
+  {
+    int r_idx = f2r[i];
+    
+    int f_row = (i+1)*stride;
+    int r_row = (r_idx+1)*stride;
+    
+    BindingSite* site = sites_f[i];
+    
+    site_occupancy_log(ncols, &rows_f.Z[f_row],   &rows_r.Z[r_row],
+                             &rows_f.Znc[f_row], &rows_r.Znc[r_row],
+                             &rows_f.Zc[f_row],  &rows_r.Zc[r_row],
+                             logZ, &kv_matrix[i*stride], occupancy_target(site));
+    store_occupancy(site);
+  }
+}
+
 void Subgroup::occupancy()
+{
+  if (engine == DYNAMIC)
+  {
+    occupancy_dynamic();
+    return;
+  }
+  
+  set_active();
+  if (ncols == 0)
+  {
+    // no tf of the subgroup is present anywhere, so no site is bound
+    int nsites = sites_f.size();
+    for (int i=0; i<nsites; i++)
+    {
+      BindingSite* site = sites_f[i];
+      std::fill(site->total_occupancy.begin(), site->total_occupancy.end(), 0.0);
+      site->mode_occupancy[0] = site->total_occupancy;
+    }
+    return;
+  }
+  
+  gather_kv();
+  switch (numerics)
+  {
+    case PLAIN:
+      if (!occupancy_plain<double>(rows_f, rows_r, DBL_MAX))
+        error("The partition function overflowed 'double'. Use Numerics auto, scaled or log");
+      break;
+    case WIDE:
+      if (!occupancy_plain<long double>(wide_f, wide_r, LDBL_MAX))
+        error("The partition function overflowed 'long double'. Use Numerics auto, scaled or log");
+      break;
+    case SCALED:
+      if (!occupancy_scaled())
+        error("The partition function exceeded the range of Numerics scaled. Use Numerics log");
+      break;
+    case LOGSPACE:
+      occupancy_log();
+      break;
+    case AUTO:
+      /* Try double first, unless the last calculation showed this subgroup
+      needs more range. Scaled rows only get an exponent once they pass
+      2^256, so if neither table did we can go back to double next time */
+      if (large || !occupancy_plain<double>(rows_f, rows_r, 0x1p512))
+      {
+        int nsites = sites_f.size();
+        if (occupancy_scaled())
+          large = (rows_f.Zexp[nsites] != 0) || (rows_r.Zexp[nsites] != 0);
+        else
+        {
+          // the rows are shared, so only the null state has to change
+          std::fill(rows_f.Z.begin(), rows_f.Z.begin() + stride, 0.0);
+          std::fill(rows_r.Z.begin(), rows_r.Z.begin() + stride, 0.0);
+          occupancy_log();
+          std::fill(rows_f.Z.begin(), rows_f.Z.begin() + stride, 1.0);
+          std::fill(rows_r.Z.begin(), rows_r.Z.begin() + stride, 1.0);
+          large = true;
+        }
+      }
+      break;
+  }
+}
+     
+void Subgroup::occupancy_dynamic()
 {
   int nsites = sites_f.size();
   int nnuc   = bindings->getNnuc();
@@ -511,7 +1120,7 @@ void Subgroup::occupancy()
         long double denom = (zfnc[j] + zfc[j])*(zrnc[j] + zrc[j]) - zrc[j]*zfc[j];
         double f  = denom/(Z[j]*kv);
         
-        if (std::isnan(f)) error("The partition function overflowed 'long double'. Recompile with VERYLARGENUMS=ON");
+        if (std::isnan(f)) error("The partition function overflowed 'long double'. Use OccupancyMethod vectorized");
         site->total_occupancy[j]   = f;
         site->mode_occupancy[0][j] = f;
       }
@@ -546,7 +1155,7 @@ void Subgroup::occupancy()
         double denom = (zfnc[j] + zfc[j])*(zrnc[j] + zrc[j]) - zrc[j]*zfc[j];
         double f  = denom/(Z[j]*kv);
         
-        if (std::isnan(f)) error("The partition function overflowed 'long double'. Recompile with LARGENUMS=ON");
+        if (std::isnan(f)) error("The partition function overflowed 'double'. Use OccupancyMethod vectorized");
         site->total_occupancy[j]   = f;
         site->mode_occupancy[0][j] = f;
       }
@@ -585,7 +1194,7 @@ void Subgroup::print(ostream& os)
 
 /******************************   Subgroups   **********************************/
 
-Subgroups::Subgroups() {}
+Subgroups::Subgroups() : engine(DYNAMIC), numerics(PLAIN) {}
 
 void Subgroups::clear()
 {
@@ -608,15 +1217,41 @@ void Subgroups::create(genes_ptr g, tfs_ptr t, bindings_ptr b, mode_ptr m)
   bindings  = b;
   mode      = m;
   
+  string method = mode->getOccupancyMethod();
+  if (method == string("dynamic"))
+    engine = DYNAMIC;
+  else if (method == string("vectorized"))
+    engine = VECTORIZED;
+  else
+    error("OccupancyMethod must be dynamic or vectorized, not " + method);
+  
+  string num = mode->getNumerics();
+  if (num == string("auto"))
+    numerics = AUTO;
+  else if (num == string("double"))
+    numerics = PLAIN;
+  else if (num == string("wide"))
+    numerics = WIDE;
+  else if (num == string("scaled"))
+    numerics = SCALED;
+  else if (num == string("log"))
+    numerics = LOGSPACE;
+  else
+    error("Numerics must be auto, double, wide, scaled or log, not " + num);
+  
   int ngenes = genes->size();
+  groups.resize(ngenes);
+  history.resize(ngenes);
   for (int i=0; i<ngenes; i++)
   {
     Gene& gene = genes->getGene(i);
-    gene_groups_ptr ggroups(new list<Subgroup>);
-    gene_groups_ptr saved_ggroups(new list<Subgroup>);
+    gene_groups_ptr   ggroups(new list<Subgroup>);
+    group_history_ptr ghistory(new GroupHistory);
+    ghistory->version = 0;
+    ghistory->saved   = false;
     
-    groups[&gene]       = ggroups;
-    saved_groups[&gene] = saved_ggroups;
+    groups[&gene]  = ggroups;
+    history[&gene] = ghistory;
   }
   
   update();
@@ -624,7 +1259,7 @@ void Subgroups::create(genes_ptr g, tfs_ptr t, bindings_ptr b, mode_ptr m)
 
 void Subgroups::addSites(Gene& gene)
 {
-  map<TF*, site_ptr_vector>& gene_sites = bindings->getSites(gene);
+  gene_sites_map& gene_sites = bindings->getSites(gene);
   list<Subgroup>& gene_groups = *(groups[&gene]);
   
   int ntfs = tfs->size();
@@ -636,6 +1271,7 @@ void Subgroups::addSites(Gene& gene)
     for (int j=0; j<nsites; j++)
       addSite(gene_groups, sites[j]);
   }
+  merge(gene_groups, coopReach());
   
   list<Subgroup>::iterator i;
   for (i=gene_groups.begin(); i != gene_groups.end(); ++i)
@@ -646,6 +1282,11 @@ void Subgroups::addSites(Gene& gene)
 }
 
 void Subgroups::addSite(list<Subgroup>& gene_groups, site_ptr site)
+{
+  addSite(gene_groups, site.get());
+}
+
+void Subgroups::addSite(list<Subgroup>& gene_groups, BindingSite* site)
 {
   list<Subgroup>::iterator i;  // iterate through list
   list<Subgroup>::iterator j;  // point to group that site was added to
@@ -662,7 +1303,7 @@ void Subgroups::addSite(list<Subgroup>& gene_groups, site_ptr site)
     
     if (condition && added==false)
     {
-      i->addSite(site.get());
+      i->addSite(site);
       added = true;
       j = i;
       i++;
@@ -676,7 +1317,7 @@ void Subgroups::addSite(list<Subgroup>& gene_groups, site_ptr site)
   }
   
   if (added==false)
-    gene_groups.push_back(Subgroup(site.get(), bindings));
+    gene_groups.push_back(Subgroup(site, bindings, engine, numerics));
 }
     
   
@@ -693,10 +1334,261 @@ void Subgroups::update()
 
 void Subgroups::update(Gene& gene)
 {
-  list<Subgroup>& ggroups = *(groups[&gene]);
-  ggroups.clear();
+  GroupHistory& ghistory = *(history[&gene]);
+  
+  // keep the saved list whole and build in a new one
+  if (ghistory.saved && !ghistory.replaced)
+  {
+    rollback(gene);
+    ghistory.replaced = groups[&gene];
+    groups[&gene]     = gene_groups_ptr(new list<Subgroup>);
+  }
+  else
+    groups[&gene]->clear();
+  
   addSites(gene);
 }
+
+// take a subgroup out of the gene, keeping it if the save still needs it
+void Subgroups::retire(Gene& gene, list<Subgroup>::iterator group)
+{
+  list<Subgroup>& ggroups = *(groups[&gene]);
+  GroupHistory&  ghistory = *(history[&gene]);
+  
+  if (ghistory.saved && group->getVersion() != ghistory.version)
+    ghistory.removed.splice(ghistory.removed.end(), ggroups, group);
+  else
+    ggroups.erase(group);
+}
+
+// undo the incremental updates since the last save
+void Subgroups::rollback(Gene& gene)
+{
+  list<Subgroup>& ggroups = *(groups[&gene]);
+  GroupHistory&  ghistory = *(history[&gene]);
+  
+  list<Subgroup>::iterator i = ggroups.begin();
+  while (i != ggroups.end())
+  {
+    if (i->getVersion() == ghistory.version)
+      i = ggroups.erase(i);
+    else
+      ++i;
+  }
+  ggroups.splice(ggroups.end(), ghistory.removed);
+}
+
+/* Two subgroups have to be one if a site of either lies within the other, or if
+any of their sites cooperate */
+bool Subgroups::interacts(Subgroup& a, Subgroup& b)
+{
+  if (a.getLeftBound() < b.getRightBound() && b.getLeftBound() < a.getRightBound())
+    return true;
+  
+  vector<BindingSite*>& sites = b.getSites();
+  int nsites = sites.size();
+  for (int i=0; i<nsites; i++)
+  {
+    if (a.checkCoop(*sites[i]))
+      return true;
+  }
+  return false;
+}
+
+// the furthest apart two sites can be and still cooperate
+int Subgroups::coopReach()
+{
+  double max_dist = 0;
+  int ntfs = tfs->size();
+  for (int i=0; i<ntfs; i++)
+    max_dist = max(max_dist, tfs->getTF(i).getMaxCoopDistance());
+  return (int) ceil(max_dist) + 1;
+}
+
+static bool compareGroupLeft(const list<Subgroup>::iterator& a, const list<Subgroup>::iterator& b)
+{
+  return a->getLeftBound() < b->getLeftBound();
+}
+
+/* addSite only compares a site to the subgroups that exist when it is added,
+so a subgroup can later grow around another without merging. Merge until no
+two subgroups interact, which makes the grouping independent of the order the
+sites were added in */
+void Subgroups::merge(list<Subgroup>& gene_groups, int reach)
+{
+  bool merged = true;
+  while (merged)
+  {
+    merged = false;
+    
+    vector<list<Subgroup>::iterator> order;
+    list<Subgroup>::iterator i;
+    for (i=gene_groups.begin(); i != gene_groups.end(); ++i)
+      order.push_back(i);
+    std::sort(order.begin(), order.end(), compareGroupLeft);
+    
+    int ngroups = order.size();
+    vector<bool> erased(ngroups, false);
+    for (int j=0; j<ngroups; j++)
+    {
+      if (erased[j]) continue;
+      Subgroup& group = *order[j];
+      for (int k=j+1; k<ngroups && order[k]->getLeftBound() < group.getRightBound() + reach; k++)
+      {
+        if (erased[k] || !interacts(group, *order[k])) 
+          continue;
+        group.addSubgroup(*order[k]);
+        gene_groups.erase(order[k]);
+        erased[k] = true;
+        merged = true;
+      }
+    }
+  }
+}
+
+/* An index of subgroup intervals sorted on left bound. With the running maximum
+of the right bounds, every subgroup that reaches into [m, n) is found with a
+binary search and a walk back over the candidates */
+
+struct SubgroupInterval
+{
+  int left_bound;
+  int right_bound;
+  list<Subgroup>::iterator group;
+};
+
+static bool compareIntervalLeft(const SubgroupInterval& a, const SubgroupInterval& b)
+{
+  return a.left_bound < b.left_bound;
+}
+
+/* When only the sites of tf change, a subgroup that lost none of its sites and
+does not interact with the regrouped sites is unchanged, so we keep it and its
+pre_processing. Everything else is pooled and regrouped. A threshold move keeps
+most tf sites, so most subgroups survive it, while a move that rescores tf
+replaces all of them. This relies on the old tf sites still being alive, which
+they are since they were saved before the update. */
+void Subgroups::update(Gene& gene, TF& tf)
+{
+  list<Subgroup>& ggroups = *(groups[&gene]);
+  GroupHistory&  ghistory = *(history[&gene]);
+  site_ptr_vector& tf_sites = bindings->getSites(gene)[&tf];
+  int ntf_sites = tf_sites.size();
+  
+  vector<BindingSite*> pool;
+  vector<SubgroupInterval> index;
+  vector<char> grouped(ntf_sites, 0); // tf sites in a subgroup we keep
+  
+  // pull apart the subgroups that held a site of tf that is gone
+  list<Subgroup>::iterator i = ggroups.begin();
+  while (i != ggroups.end())
+  {
+    vector<BindingSite*>& sites = i->getSites();
+    int nsites = sites.size();
+    
+    bool touched = false;
+    for (int j=0; j<nsites; j++)
+    {
+      BindingSite* b = sites[j];
+      if (b->tf != &tf) continue;
+      int idx = b->index_in_site_map;
+      if (idx >= ntf_sites || tf_sites[idx].get() != b)
+      {
+        touched = true;
+        break;
+      }
+    }
+    
+    if (touched)
+    {
+      for (int j=0; j<nsites; j++)
+      {
+        if (sites[j]->tf != &tf)
+          pool.push_back(sites[j]);
+      }
+      retire(gene, i++);
+    }
+    else
+    {
+      for (int j=0; j<nsites; j++)
+      {
+        if (sites[j]->tf == &tf)
+          grouped[sites[j]->index_in_site_map] = 1;
+      }
+      
+      SubgroupInterval interval;
+      interval.left_bound  = i->getLeftBound();
+      interval.right_bound = i->getRightBound();
+      interval.group       = i;
+      index.push_back(interval);
+      ++i;
+    }
+  }
+  
+  for (int j=0; j<ntf_sites; j++)
+  {
+    if (!grouped[j])
+      pool.push_back(tf_sites[j].get());
+  }
+  
+  list<Subgroup> new_groups;
+  int npool = pool.size();
+  for (int j=0; j<npool; j++)
+    addSite(new_groups, pool[j]);
+  
+  std::sort(index.begin(), index.end(), compareIntervalLeft);
+  int nintervals = index.size();
+  vector<int>  max_right(nintervals);
+  vector<bool> absorbed(nintervals, false);
+  for (int j=0; j<nintervals; j++)
+    max_right[j] = max(index[j].right_bound, j ? max_right[j-1] : INT_MIN);
+  
+  /* the kept subgroups never interact with each other, so we only need to
+  absorb those that interact with a new one. Absorbing grows the new subgroup,
+  so repeat until nothing else is in reach */
+  int  reach = coopReach();
+  bool grown = true;
+  while (grown)
+  {
+    grown = false;
+    merge(new_groups, reach);
+    
+    for (i=new_groups.begin(); i != new_groups.end(); ++i)
+    {
+      SubgroupInterval query;
+      query.left_bound = i->getRightBound() + reach;
+      int m = i->getLeftBound() - reach;
+      int k = std::lower_bound(index.begin(), index.end(), query, compareIntervalLeft) - index.begin() - 1;
+      for (; k>=0 && max_right[k] > m; k--)
+      {
+        if (absorbed[k] || index[k].right_bound <= m) 
+          continue;
+        
+        if (interacts(*i, *index[k].group))
+        {
+          i->addSubgroup(*index[k].group);
+          absorbed[k] = true;
+          grown = true;
+        }
+      }
+    }
+  }
+  
+  for (int j=0; j<nintervals; j++)
+  {
+    if (absorbed[j])
+      retire(gene, index[j].group);
+  }
+  
+  // only pre_process what is new
+  for (i=new_groups.begin(); i != new_groups.end(); ++i)
+  {
+    i->sort();
+    i->pre_process();
+    i->setVersion(ghistory.version);
+  }
+  ggroups.splice(ggroups.end(), new_groups);
+}
  
 
 void Subgroups::calc_f()
@@ -715,6 +1607,43 @@ void Subgroups::calc_f(Gene& gene)
 }
 
 
+bool Subgroups::touches(Subgroup& group, TF& tf1, TF& tf2)
+{
+  return group.hasTF(&tf1) && group.hasTF(&tf2);
+}
+
+void Subgroups::calc_f(Gene& gene, TF& tf1, TF& tf2)
+{
+  list<Subgroup>& gene_groups = *(groups[&gene]);
+  list<Subgroup>::iterator i;
+  for (i=gene_groups.begin(); i != gene_groups.end(); ++i)
+  {
+    if (touches(*i, tf1, tf2))
+      i->occupancy();
+  }
+}
+
+void Subgroups::saveOccupancy(Gene& gene, TF& tf1, TF& tf2)
+{
+  list<Subgroup>& gene_groups = *(groups[&gene]);
+  list<Subgroup>::iterator i;
+  for (i=gene_groups.begin(); i != gene_groups.end(); ++i)
+  {
+    if (!touches(*i, tf1, tf2)) continue;
+    
+    vector<BindingSite*>& sites = i->getSites();
+    int nsites = sites.size();
+    for (int j=0; j<nsites; j++)
+      sites[j]->total_occupancy.swap(sites[j]->saved_total_occupancy);
+  }
+}
+
+// the same swap, the subgroups have not changed since the save
+void Subgroups::restoreOccupancy(Gene& gene, TF& tf1, TF& tf2)
+{
+  saveOccupancy(gene, tf1, tf2);
+}
+
 void Subgroups::save()
 {
   int ngenes = genes->size();
@@ -722,11 +1651,14 @@ void Subgroups::save()
     save(genes->getGene(i));
 }
 
+// the current subgroups become the save, and what the last move replaced is dropped
 void Subgroups::save(Gene& gene)
 {
-  list<Subgroup>& gene_groups       = *(groups[&gene]);
-  list<Subgroup>& saved_gene_groups = *(saved_groups[&gene]);
-  saved_gene_groups = gene_groups;
+  GroupHistory& ghistory = *(history[&gene]);
+  ghistory.removed.clear();
+  ghistory.replaced.reset();
+  ghistory.version++;
+  ghistory.saved = true;
 }
 
 void Subgroups::restore()
@@ -738,9 +1670,18 @@ void Subgroups::restore()
 
 void Subgroups::restore(Gene& gene)
 {
-  list<Subgroup>& gene_groups       = *(groups[&gene]);
-  list<Subgroup>& saved_gene_groups = *(saved_groups[&gene]);
-  gene_groups = saved_gene_groups;
+  GroupHistory& ghistory = *(history[&gene]);
+  if (!ghistory.saved) return;
+  
+  if (ghistory.replaced)
+  {
+    groups[&gene] = ghistory.replaced;
+    ghistory.replaced.reset();
+  }
+  else
+    rollback(gene);
+  
+  ghistory.saved = false;
 }
 
 void Subgroups::print(ostream& os)
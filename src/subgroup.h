@@ -17,6 +17,8 @@
 #include <list>
 #include <map>
 #include <bitset>
+#include <stdint.h>
+#include <boost/align/aligned_allocator.hpp>
 
 
 /* for every site we need to know some information for calculating either
@@ -48,6 +50,58 @@ struct Partition
 #endif
   
 };
+
+
+/* The vectorized engine runs the same recursion as above, but instead of one
+Partition per site it keeps each table as a contiguous [partition][nucleus]
+matrix. Rows are padded to a multiple of SIMD_WIDTH nuclei and allocated on
+cache line boundaries, so the inner nuclei loops are unit stride with no
+remainder and the compiler is free to vectorize them.
+
+The interactions are held in a PartitionTable, and the partition functions in
+PartitionRows, which are templated on the scalar type. How overflow is handled
+is chosen at runtime by the Numerics mode:
+
+  double  - Z is stored directly. Fastest, but can overflow on large clusters
+  wide    - Z is stored directly in long double. Has the range of the old
+            LARGENUMS builds, but long double cannot use SIMD
+  scaled  - every row holds double mantissas and a shared int64 exponent,
+            Z[pindex][nuc] = Z[pindex*stride + nuc] * 2^Zexp[pindex]. Nuclei
+            far below the largest one in a row lose their mantissa
+  log     - Z holds log(Z), while Zc and Znc hold their fraction of Z
+  auto    - each subgroup runs in double, and falls back to scaled only while
+            its partition function is too large for double, and to log when
+            its nuclei are too far apart for one exponent                   */
+
+#define SIMD_WIDTH 8
+
+template<typename T> struct aligned_vector
+{
+  typedef vector<T, boost::alignment::aligned_allocator<T, 64> > type;
+};
+typedef aligned_vector<double>::type aligned_dvector;
+
+struct PartitionTable
+{
+  vector<int>      last;       // last[pindex], as in Partition
+  vector<int>      kv_row;     // the row of the subgroup kv matrix for each site
+  vector<int>      coop_start; // coops of pindex are coop_start[pindex-1] to coop_start[pindex]
+  vector<int>      coop_row;   // the kv row of the site it coops with
+  vector<int>      coop_past;  // the last partition index the coop state doesnt compete with
+  vector<double>   dist_coef;  // the distance coefficient of this cooperative interaction
+  vector<coop_ptr> coop;
+};
+
+template<typename T> struct PartitionRows
+{
+  typename aligned_vector<T>::type Z;   // Z[pindex*stride + nuc]
+  typename aligned_vector<T>::type Zc;  // the partial partition function, cooperating
+  typename aligned_vector<T>::type Znc; // the partial partition function, non-cooperating
+  vector<int64_t> Zexp;                 // the exponent of each row, if scaled
+};
+
+enum occupancy_engines { DYNAMIC = 0, VECTORIZED = 1 };
+enum numeric_modes     { PLAIN = 0, WIDE = 1, SCALED = 2, LOGSPACE = 3, AUTO = 4 };
   
 
 
@@ -59,21 +113,60 @@ private:
   vector<BindingSite*> sites_f; // the pointers to sites in the subgroup
   vector<BindingSite*> sites_r; // the pointers to sites in the subgroup, in reverse order
   vector<int> f2r;              // maps forward index onto reverse index
+  vector<TF*> factors;          // the tfs with sites in the subgroup, sorted
   
   int right_bound;            // the right most position in the set
   int left_bound;             // the left most position in the set
   bindings_ptr  bindings;     // pointer to master bindings
 
+  int engine;                 // which occupancy engine to use
+  int numerics;               // how the vectorized engine avoids overflow
+  bool large;                 // in auto, whether the last Z was too large for double
+  unsigned version;           // the save the subgroup was made after, see GroupHistory
+  
   vector<Partition> ZF; // forward partition function
   vector<Partition> ZR; // reverse partition function
   
+  // for the vectorized engine
+  int             stride;    // nnuc padded to a multiple of SIMD_WIDTH
+  aligned_dvector kv_matrix; // kv_matrix[f_index*stride + nuc]
+  PartitionTable  table_f;   // forward partition table
+  PartitionTable  table_r;   // reverse partition table
+  
+  PartitionRows<double>      rows_f; // forward partition functions
+  PartitionRows<double>      rows_r; // reverse partition functions
+  PartitionRows<long double> wide_f; // the same, for Numerics wide
+  PartitionRows<long double> wide_r;
+  
+  /* nuclei where no tf of the subgroup is present have kv 0 at every site, so
+  Z is 1 and nothing is bound. The rows then only hold the other nuclei */
+  vector<int>     active;         // runs of nuclei the rows hold, as start,end pairs
+  unsigned        active_version; // the bindings activity active was made from
+  int             ncols;          // the nuclei the rows hold
+  int             width;          // ncols padded to a multiple of SIMD_WIDTH
+  vector<double>  occ;            // occupancy of the nuclei the rows hold
+  
   void pre_process_pair(vector<Partition>&, int, BindingSite*, TF*, char, int, BindingSite*, TF*, char);
   void iterate_partition(vector<Partition>& Z, vector<BindingSite*>& sites, int site_index);
+  
+  void compile_table(vector<Partition>&, vector<int>& kv_rows, PartitionTable&);
+  template<typename T> void init_rows(PartitionRows<T>&, T null_Z);
+  void set_active();
+  void gather_kv();
+  double* occupancy_target(BindingSite*);
+  void store_occupancy(BindingSite*);
+  template<typename T> void iterate_table(PartitionTable&, PartitionRows<T>&, int site_index);
+  bool iterate_table_scaled(PartitionTable&, PartitionRows<double>&, int site_index);
+  void iterate_table_log(PartitionTable&, PartitionRows<double>&, int site_index);
+  void occupancy_dynamic();
+  template<typename T> bool occupancy_plain(PartitionRows<T>&, PartitionRows<T>&, T limit);
+  bool occupancy_scaled();
+  void occupancy_log();
 
 public:
   // constructors
   Subgroup();
-  Subgroup(BindingSite*, bindings_ptr);
+  Subgroup(BindingSite*, bindings_ptr, int engine, int numerics);
   
   // setters
   void addSite(BindingSite*);
@@ -84,6 +177,10 @@ public:
   vector<BindingSite*>& getSites();
   int                   getRightBound() const;
   int                   getLeftBound() const;
+  unsigned              getVersion() const;
+  bool                  hasTF(TF*) const;
+  
+  void setVersion(unsigned v);
   
   // methods
   bool overlaps(BindingSite&);
@@ -101,20 +198,49 @@ public:
 
   
 typedef boost::shared_ptr<list<Subgroup> > gene_groups_ptr;
+
+/* Saving the subgroups of a gene does not copy them. Instead, moves keep what
+they replaced until the next save. An incremental update moves the subgroups it
+replaces into removed, and tags the ones it makes with the current version, so
+restoring erases the tagged subgroups and splices the removed ones back. A full
+update keeps the whole list in replaced and builds a new one */
+struct GroupHistory
+{
+  unsigned        version;  // bumped on every save
+  bool            saved;    // whether there is a save to restore to
+  list<Subgroup>  removed;  // subgroups taken out since the save
+  gene_groups_ptr replaced; // the saved list, if the gene was rebuilt since
+};
+
+typedef boost::shared_ptr<GroupHistory> group_history_ptr;
+
 class Subgroups
 {
 private:
   //maps gene to subgroup
-  map<Gene*, gene_groups_ptr > groups;
-  map<Gene*, gene_groups_ptr > saved_groups;
+  IndexMap<Gene, gene_groups_ptr >   groups;
+  IndexMap<Gene, group_history_ptr > history;
   
   genes_ptr     genes;
   tfs_ptr       tfs;
   bindings_ptr  bindings;
   mode_ptr      mode;
   
+  int engine;   // the occupancy engine given to new subgroups
+  int numerics; // and the numeric mode they use
+  
   void addSites(Gene&);
   void addSite(list<Subgroup>&, site_ptr);
+  void addSite(list<Subgroup>&, BindingSite*);
+  
+  void retire(Gene&, list<Subgroup>::iterator);
+  void rollback(Gene&);
+  
+  bool touches(Subgroup&, TF&, TF&);
+  
+  bool interacts(Subgroup&, Subgroup&);
+  int  coopReach();
+  void merge(list<Subgroup>&, int reach);
   
 public:
   Subgroups();
@@ -127,12 +253,21 @@ public:
   void clear(Gene&);
   void save(Gene&);
   void update(Gene&);
+  void update(Gene&, TF&); // when only the sites of one tf changed
   void restore(Gene&);
   
   void create(genes_ptr, tfs_ptr, bindings_ptr, mode_ptr); 
 
   void calc_f();
   void calc_f(Gene&);
+  
+  /* when only the kv of a tf, or the cooperativity of a pair, changed, only
+  subgroups with sites of both tfs need their occupancy recalculated. Pass the
+  same tf twice for a single tf. Saving swaps total occupancy for just those
+  sites, as Bindings does for the whole gene */
+  void calc_f(Gene&, TF&, TF&);
+  void saveOccupancy(Gene&, TF&, TF&);
+  void restoreOccupancy(Gene&, TF&, TF&);
   //void calc_f(int nuc_idx);
   
   void print(ostream& os);
@@ -0,0 +1,89 @@
+/*********************************************************************************
+*                                                                                *
+*     vmath.h                                                                    *
+*                                                                                *
+*     Inline math functions that vectorize in loops over nuclei                  *
+*                                                                                *
+*********************************************************************************/
+
+#ifndef VMATH_H
+#define VMATH_H
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+/* Branch free exp and log for loops over nuclei. Unlike the libm versions
+these inline into the loops, so the compiler can vectorize them. Both are
+accurate to a few ulp (relative error below 1e-15) for normal arguments.
+vexp clamps x to [-708, 709], so below -708 it returns exp(-708), about
+3.3e-308, rather than 0. vlog expects x >= DBL_MIN */
+
+static const double EXP_SHIFT = 6755399441055744.0; // 1.5*2^52, rounds to integer
+static const double LN2_HI    = 6.93147180369123816490e-01;
+static const double LN2_LO    = 1.90821492927058770002e-10;
+
+inline double bits2double(uint64_t b) { double d; memcpy(&d, &b, sizeof(d)); return d; }
+inline uint64_t double2bits(double d) { uint64_t b; memcpy(&b, &d, sizeof(b)); return b; }
+
+inline double vexp(double x)
+{
+  x = std::max(x, -708.0);
+  x = std::min(x,  709.0);
+  
+  // x = n*ln2 + r, with |r| <= ln2/2
+  double t = x*1.4426950408889634 + EXP_SHIFT;
+  double n = t - EXP_SHIFT;
+  double r = x - n*LN2_HI;
+  r = r - n*LN2_LO;
+  
+  // taylor series of exp(r) to 12th order
+  double p = 1.0/479001600.0;
+  p = p*r + 1.0/39916800.0;
+  p = p*r + 1.0/3628800.0;
+  p = p*r + 1.0/362880.0;
+  p = p*r + 1.0/40320.0;
+  p = p*r + 1.0/5040.0;
+  p = p*r + 1.0/720.0;
+  p = p*r + 1.0/120.0;
+  p = p*r + 1.0/24.0;
+  p = p*r + 1.0/6.0;
+  p = p*r + 0.5;
+  p = p*r + 1.0;
+  p = p*r + 1.0;
+  
+  // multiply by 2^n by building the exponent directly
+  uint64_t k = double2bits(t) - double2bits(EXP_SHIFT);
+  return p*bits2double((k + 1023) << 52);
+}
+
+inline double vlog(double x)
+{
+  // x = m*2^e, with sqrt(1/2) <= m < sqrt(2)
+  uint64_t b   = double2bits(x);
+  uint64_t e   = (b >> 52) & 0x7ff;
+  double   m   = bits2double((b & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+  uint64_t big = ((double2bits(m*0.70710678118654752) >> 52) & 0x7ff) - 1022;
+  m = m*bits2double(0x3ff0000000000000ULL - (big << 52));
+  e = e + big;
+  
+  // log(m) = 2*atanh(s), s = (m-1)/(m+1)
+  double s  = (m - 1.0)/(m + 1.0);
+  double s2 = s*s;
+  double p  = 2.0/21;
+  p = p*s2 + 2.0/19;
+  p = p*s2 + 2.0/17;
+  p = p*s2 + 2.0/15;
+  p = p*s2 + 2.0/13;
+  p = p*s2 + 2.0/11;
+  p = p*s2 + 2.0/9;
+  p = p*s2 + 2.0/7;
+  p = p*s2 + 2.0/5;
+  p = p*s2 + 2.0/3;
+  p = p*s2 + 2.0;
+  
+  double de = (bits2double(e | 0x4330000000000000ULL) - 4503599627370496.0) - 1023.0;
+  return de*LN2_HI + (de*LN2_LO + p*s);
+}
+
+#endif